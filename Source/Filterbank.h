@@ -0,0 +1,230 @@
+//
+//  Filterbank.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <cmath>
+#include <vector>
+
+/** Groups the bins of an FFT into musically spaced bands, e.g. for a display
+    that gives every octave the same room.
+    
+    Each band is a kernel of weights over a contiguous run of bins, so the
+    whole bank is a sparse matrix with only the non-zero weights stored, one
+    run after another. Building it is done once per FFT size and sample rate;
+    applying it is one short dot product per band.
+    
+    The kernels are normalised so their weights sum to 1, and applied to the
+    power spectrum, so every band's level is the RMS magnitude of its bins.
+ */
+class Filterbank
+{
+public:
+    
+    /** How the bands are spaced and shaped. */
+    enum class Scale
+    {
+        constantQ,      // Evenly spaced in log frequency, triangular, every band has the same Q
+        mel,            // Evenly spaced on the mel scale, triangular, like speech and hearing models
+        thirdOctave     // The standard third octave bands around 1kHz, rectangular
+    };
+    
+    Filterbank() = default;
+    
+    /** Builds the kernels. Allocates, so don't call it from a realtime thread.
+    
+        @param scale            how to space the bands
+        @param fftSize          the FFT size the spectra come from
+        @param sampleRate       the sample rate of the analysed audio
+        @param maxNumBands      the most bands to build. Constant Q and mel
+                                banks always have this many, third octave
+                                banks have one per standard band in the range,
+                                dropping the lowest ones if there are too many.
+        @param minFrequency     the lowest band's centre, in Hz
+        @param maxFrequency     the highest band's centre, in Hz, limited to
+                                below half the sample rate
+     */
+    void build (Scale scale, int fftSize, double sampleRate, int maxNumBands,
+                float minFrequency = 30.0f, float maxFrequency = 16000.0f)
+    {
+        jassert (fftSize > 0 && sampleRate > 0.0 && maxNumBands > 1);
+        
+        const int numBins = fftSize / 2 + 1;
+        const double binWidth = sampleRate / fftSize;
+        const double topFrequency = jmin ((double) maxFrequency, 0.45 * sampleRate);
+        const double bottomFrequency = jlimit (binWidth * 0.5, topFrequency * 0.5, (double) minFrequency);
+        
+        // Each band is described by its lower edge, centre and upper edge
+        std::vector<double> centres, lowerEdges, upperEdges;
+        
+        if (scale == Scale::thirdOctave)
+        {
+            // Standard centres are 1kHz * 2^(n/3), with edges a sixth of an
+            // octave either side
+            const int lowestBand = (int) std::ceil (3.0 * std::log2 (bottomFrequency / 1000.0));
+            const int highestBand = (int) std::floor (3.0 * std::log2 (topFrequency / 1000.0));
+            
+            for (int band = jmax (lowestBand, highestBand - maxNumBands + 1); band <= highestBand; ++band)
+            {
+                const double centre = 1000.0 * std::exp2 (band / 3.0);
+                centres.push_back (centre);
+                lowerEdges.push_back (centre * std::exp2 (-1.0 / 6.0));
+                upperEdges.push_back (centre * std::exp2 (1.0 / 6.0));
+            }
+        }
+        else
+        {
+            // Evenly spaced on the warped scale, with every triangle reaching
+            // to its neighbours' centres
+            auto warp = [scale] (double frequency)
+            {
+                return scale == Scale::mel ? 2595.0 * std::log10 (1.0 + frequency / 700.0)
+                                           : std::log (frequency);
+            };
+            
+            auto unwarp = [scale] (double warped)
+            {
+                return scale == Scale::mel ? 700.0 * (std::pow (10.0, warped / 2595.0) - 1.0)
+                                           : std::exp (warped);
+            };
+            
+            const double warpedBottom = warp (bottomFrequency);
+            const double warpedStep = (warp (topFrequency) - warpedBottom) / (maxNumBands - 1);
+            
+            for (int band = 0; band < maxNumBands; ++band)
+            {
+                centres.push_back (unwarp (warpedBottom + band * warpedStep));
+                lowerEdges.push_back (unwarp (warpedBottom + (band - 1) * warpedStep));
+                upperEdges.push_back (unwarp (warpedBottom + (band + 1) * warpedStep));
+            }
+        }
+        
+        const bool triangular = scale != Scale::thirdOctave;
+        
+        kernels.clear();
+        weights.clear();
+        centreFrequencies.clear();
+        
+        for (size_t band = 0; band < centres.size(); ++band)
+        {
+            Kernel kernel;
+            kernel.weightOffset = (int) weights.size();
+            kernel.startBin = jmax (0, (int) std::ceil (lowerEdges[band] / binWidth));
+            
+            const int endBin = jmin (numBins, (int) std::floor (upperEdges[band] / binWidth) + 1);
+            
+            for (int bin = kernel.startBin; bin < endBin; ++bin)
+            {
+                const double frequency = bin * binWidth;
+                double weight = 1.0;
+                
+                if (triangular)
+                    weight = frequency < centres[band] ? (frequency - lowerEdges[band]) / (centres[band] - lowerEdges[band])
+                                                       : (upperEdges[band] - frequency) / (upperEdges[band] - centres[band]);
+                
+                weights.push_back ((float) jmax (0.0, weight));
+            }
+            
+            kernel.numWeights = (int) weights.size() - kernel.weightOffset;
+            
+            // Bands narrower than a bin fall between the bins, so interpolate
+            // between the two bins either side of the centre instead
+            float weightSum = 0.0f;
+            
+            for (int i = 0; i < kernel.numWeights; ++i)
+                weightSum += weights[(size_t) (kernel.weightOffset + i)];
+            
+            if (weightSum <= 0.0f)
+            {
+                weights.resize ((size_t) kernel.weightOffset);
+                
+                const double centreBin = jmin (centres[band] / binWidth, (double) numBins - 1.0);
+                const double fraction = centreBin - std::floor (centreBin);
+                
+                kernel.startBin = jmin ((int) centreBin, numBins - 2);
+                kernel.numWeights = 2;
+                weights.push_back ((float) (1.0 - fraction));
+                weights.push_back ((float) fraction);
+                weightSum = 1.0f;
+            }
+            
+            for (int i = 0; i < kernel.numWeights; ++i)
+                weights[(size_t) (kernel.weightOffset + i)] /= weightSum;
+            
+            kernels.push_back (kernel);
+            centreFrequencies.push_back ((float) centres[band]);
+        }
+    }
+    
+    /** Returns the number of bands, lowest frequency first. */
+    int getNumBands() const noexcept                    { return (int) kernels.size(); }
+    
+    /** Returns the centre frequency of a band, in Hz. */
+    float getCentreFrequency (int band) const           { return centreFrequencies[(size_t) band]; }
+    
+    /** Applies the bank to a power spectrum (squared magnitudes) from the FFT
+        size it was built for. Doesn't allocate.
+        
+        @param powerSpectrum    fftSize / 2 + 1 squared magnitudes
+        @param bandLevels       receives getNumBands() RMS magnitudes, lowest
+                                frequency first
+     */
+    void process (const float* powerSpectrum, float* bandLevels) const noexcept
+    {
+        const float* kernelWeights = weights.data();
+        
+        for (size_t band = 0; band < kernels.size(); ++band)
+        {
+            const Kernel& kernel = kernels[band];
+            const float power = dotProduct (kernelWeights + kernel.weightOffset,
+                                            powerSpectrum + kernel.startBin, kernel.numWeights);
+            
+            bandLevels[band] = std::sqrt (jmax (0.0f, power));
+        }
+    }
+
+private:
+    
+    /** The dot product of two runs of floats. Four independent sums let the
+        compiler keep them in one vector register, which it can't do with a
+        single running sum without reordering floating point additions.
+     */
+    static float dotProduct (const float* a, const float* b, int num) noexcept
+    {
+        float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+        int i = 0;
+        
+        for (; i + 4 <= num; i += 4)
+        {
+            sum0 += a[i]     * b[i];
+            sum1 += a[i + 1] * b[i + 1];
+            sum2 += a[i + 2] * b[i + 2];
+            sum3 += a[i + 3] * b[i + 3];
+        }
+        
+        for (; i < num; ++i)
+            sum0 += a[i] * b[i];
+        
+        return (sum0 + sum1) + (sum2 + sum3);
+    }
+    
+    /** The non-zero weights of one band, from startBin onwards. */
+    struct Kernel
+    {
+        int startBin;
+        int numWeights;
+        int weightOffset;       // Where the weights start in weights
+    };
+    
+    std::vector<Kernel> kernels;
+    std::vector<float> weights;             // Every kernel's weights, one after another
+    std::vector<float> centreFrequencies;
+    
+    JUCE_LEAK_DETECTOR (Filterbank)
+};
@@ -0,0 +1,301 @@
+//
+//  GLResources.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+
+// Buffer textures are core in OpenGL 3.1, but not every platform's headers
+// name them
+#ifndef GL_TEXTURE_BUFFER
+ #define GL_TEXTURE_BUFFER 0x8C2A
+#endif
+
+#ifndef GL_MAX_TEXTURE_BUFFER_SIZE
+ #define GL_MAX_TEXTURE_BUFFER_SIZE 0x8C2B
+#endif
+
+#ifndef GL_R32F
+ #define GL_R32F 0x822E
+#endif
+
+/** Owns one OpenGL object for as long as a GL context is open.
+    
+    The visualizers create their objects once in newOpenGLContextCreated() and
+    release them in openGLContextClosing(), both of which run with the context
+    active. Rendering only binds them and, where the data changes, updates
+    them in place, so no objects are made or lost per frame.
+    
+    Every kind of object keeps a count of how many are alive across all
+    contexts, so a leak shows up as a count that doesn't return to zero once
+    every visualizer has been deleted.
+    
+    @see GLBuffer, GLVertexArray, GLTexture
+ */
+template <typename ObjectType>
+class GLObject
+{
+public:
+    
+    GLObject() = default;
+    
+    /** Releases the object if it is still alive and its context is active.
+        Otherwise it can't be freed, so it asserts instead.
+     */
+    ~GLObject()
+    {
+        if (id != 0 && OpenGLContext::getCurrentContext() == context)
+            release();
+        
+        // Release GL objects in openGLContextClosing(), while the context is active
+        jassert (id == 0);
+    }
+    
+    /** Generates the object. Call with the context active. */
+    void create (OpenGLContext& contextToUse)
+    {
+        jassert (OpenGLHelpers::isContextActive());
+        
+        release();
+        context = &contextToUse;
+        ObjectType::generate (context->extensions, id);
+        
+        if (id != 0)
+            ++liveCount;
+    }
+    
+    /** Deletes the object, if there is one. Call with the context active. */
+    void release()
+    {
+        if (id == 0)
+            return;
+        
+        jassert (OpenGLHelpers::isContextActive());
+        
+        ObjectType::destroy (context->extensions, id);
+        id = 0;
+        --liveCount;
+    }
+    
+    /** Returns the object's name, or 0 before create() and after release(). */
+    GLuint get() const noexcept             { return id; }
+    
+    bool isValid() const noexcept           { return id != 0; }
+    
+    /** Returns how many objects of this kind are alive, for leak checks. */
+    static int getNumLive() noexcept        { return liveCount.load(); }
+
+protected:
+    
+    OpenGLExtensionFunctions& extensions() const noexcept
+    {
+        jassert (context != nullptr);
+        return context->extensions;
+    }
+    
+    GLuint id = 0;
+    OpenGLContext* context = nullptr;
+
+private:
+    
+    static inline std::atomic<int> liveCount { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE (GLObject)
+};
+
+
+//==============================================================================
+/** A vertex array object, which remembers the attribute layout and element
+    buffer bound while it is.
+ */
+class GLVertexArray  : public GLObject<GLVertexArray>
+{
+public:
+    
+    void bind() const noexcept              { extensions().glBindVertexArray (id); }
+    void unbind() const noexcept            { extensions().glBindVertexArray (0); }
+    
+    static void generate (OpenGLExtensionFunctions& gl, GLuint& name)    { gl.glGenVertexArrays (1, &name); }
+    static void destroy (OpenGLExtensionFunctions& gl, GLuint& name)     { gl.glDeleteVertexArrays (1, &name); }
+};
+
+
+//==============================================================================
+/** A buffer object, e.g. vertices (GL_ARRAY_BUFFER) or indices
+    (GL_ELEMENT_ARRAY_BUFFER).
+ */
+class GLBuffer  : public GLObject<GLBuffer>
+{
+public:
+    
+    /** Generates the buffer and sets what it's bound to. */
+    void create (OpenGLContext& contextToUse, GLenum bufferTarget)
+    {
+        GLObject<GLBuffer>::create (contextToUse);
+        target = bufferTarget;
+    }
+    
+    void bind() const noexcept              { extensions().glBindBuffer (target, id); }
+    void unbind() const noexcept            { extensions().glBindBuffer (target, 0); }
+    
+    /** Binds the buffer and (re)allocates its storage with new contents. Only
+        for setup, use update() for data that changes every frame.
+     */
+    void upload (const void* data, size_t numBytes, GLenum usage)
+    {
+        bind();
+        extensions().glBufferData (target, (GLsizeiptr) numBytes, data, usage);
+    }
+    
+    /** Binds the buffer and overwrites part of it, keeping its storage. */
+    void update (const void* data, size_t byteOffset, size_t numBytes)
+    {
+        bind();
+        extensions().glBufferSubData (target, (GLintptr) byteOffset, (GLsizeiptr) numBytes, data);
+    }
+    
+    static void generate (OpenGLExtensionFunctions& gl, GLuint& name)    { gl.glGenBuffers (1, &name); }
+    static void destroy (OpenGLExtensionFunctions& gl, GLuint& name)     { gl.glDeleteBuffers (1, &name); }
+
+private:
+    
+    GLenum target = GL_ARRAY_BUFFER;
+};
+
+
+//==============================================================================
+/** A texture object. */
+class GLTexture  : public GLObject<GLTexture>
+{
+public:
+    
+    static void generate (OpenGLExtensionFunctions&, GLuint& name)       { glGenTextures (1, &name); }
+    static void destroy (OpenGLExtensionFunctions&, GLuint& name)        { glDeleteTextures (1, &name); }
+};
+
+
+//==============================================================================
+/** A window of audio samples on the GPU, for shaders to read with texelFetch()
+    from a samplerBuffer.
+    
+    The samples live in a buffer object seen through a buffer texture, so the
+    window can hold thousands of samples where a uniform array would run out
+    of uniform space, and updating it is one glBufferSubData() of just the
+    samples that are shown.
+ */
+class GLSampleBuffer
+{
+public:
+    
+    GLSampleBuffer() = default;
+    
+    /** Allocates room for maxNumSamples floats, all zero to begin with. Call
+        with the context active.
+        
+        @returns    false if the driver doesn't support buffer textures
+     */
+    bool create (OpenGLContext& contextToUse, int maxNumSamples)
+    {
+        release();
+        
+        // glTexBuffer() isn't one of JUCE's extension functions, so look it up
+        texBuffer = (TexBufferFunction) OpenGLHelpers::getExtensionFunction ("glTexBuffer");
+        
+        if (texBuffer == nullptr)
+            return false;
+        
+        context = &contextToUse;
+        capacity = maxNumSamples;
+        
+        HeapBlock<GLfloat> silence ((size_t) capacity, true);
+        
+        buffer.create (contextToUse, GL_TEXTURE_BUFFER);
+        buffer.upload (silence, sizeof(GLfloat) * (size_t) capacity, GL_STREAM_DRAW);
+        buffer.unbind();
+        
+        texture.create (contextToUse);
+        glBindTexture (GL_TEXTURE_BUFFER, texture.get());
+        texBuffer (GL_TEXTURE_BUFFER, GL_R32F, buffer.get());
+        glBindTexture (GL_TEXTURE_BUFFER, 0);
+        
+        return true;
+    }
+    
+    /** Frees the buffer and texture. Call with the context active. */
+    void release()
+    {
+        texture.release();
+        buffer.release();
+        capacity = 0;
+    }
+    
+    bool isValid() const noexcept           { return texture.isValid(); }
+    
+    /** Returns the number of samples the buffer holds. */
+    int getCapacity() const noexcept        { return capacity; }
+    
+    /** Returns the most samples create() can allocate on this driver, which
+        the spec only guarantees to be 65536. Call with the context active.
+     */
+    static int getMaxCapacity()
+    {
+        // A driver that doesn't know the query leaves it unset
+        GLint maxTexels = 0;
+        glGetIntegerv (GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        
+        return maxTexels > 0 ? (int) maxTexels : 65536;
+    }
+    
+    /** Overwrites numSamples samples from startSample onwards, e.g. one row of
+        a history of windows kept side by side.
+     */
+    void update (const GLfloat* samples, int numSamples, int startSample = 0)
+    {
+        jassert (startSample >= 0 && startSample + numSamples <= capacity);
+        
+        buffer.update (samples, sizeof(GLfloat) * (size_t) startSample,
+                       sizeof(GLfloat) * (size_t) jmin (numSamples, capacity - startSample));
+        buffer.unbind();
+    }
+    
+    /** Binds the texture to a texture unit, for a samplerBuffer uniform set to
+        the same unit. Does nothing if create() failed, so callers can bind
+        and unbind unconditionally.
+     */
+    void bind (int textureUnit) const
+    {
+        if (! isValid())
+            return;
+        
+        context->extensions.glActiveTexture ((GLenum) (GL_TEXTURE0 + textureUnit));
+        glBindTexture (GL_TEXTURE_BUFFER, texture.get());
+    }
+    
+    void unbind (int textureUnit) const
+    {
+        if (! isValid())
+            return;
+        
+        context->extensions.glActiveTexture ((GLenum) (GL_TEXTURE0 + textureUnit));
+        glBindTexture (GL_TEXTURE_BUFFER, 0);
+        context->extensions.glActiveTexture (GL_TEXTURE0);
+    }
+
+private:
+    
+    typedef void (JUCE_GLAPIENTRY* TexBufferFunction) (GLenum target, GLenum internalFormat, GLuint buffer);
+    
+    GLBuffer buffer;
+    GLTexture texture;
+    OpenGLContext* context = nullptr;
+    TexBufferFunction texBuffer = nullptr;
+    int capacity = 0;
+    
+    JUCE_DECLARE_NON_COPYABLE (GLSampleBuffer)
+};
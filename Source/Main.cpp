@@ -9,6 +9,8 @@
 */
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBufferBenchmark.h"
+#include "RingBufferStressTest.h"
 
 Component* createMainContentComponent();
 
@@ -28,6 +30,22 @@ public:
     {
         // This method is where you should put your application's initialisation code..
 
+        // Headless modes, these run without opening a window or an audio device
+        if (commandLine.contains ("--benchmark-ringbuffer"))
+        {
+            RingBufferBenchmark::run (ArgumentList ({}, getCommandLineParameterArray())
+                                          .getValueForOption ("--benchmark-output"));
+            quit();
+            return;
+        }
+
+        if (commandLine.contains ("--stress-ringbuffer"))
+        {
+            setApplicationReturnValue (RingBufferStressTest::run() ? 0 : 1);
+            quit();
+            return;
+        }
+
         mainWindow = std::make_unique<MainWindow> (getApplicationName());
     }
 
@@ -97,6 +115,25 @@ private:
     std::unique_ptr<MainWindow> mainWindow;
 };
 
+//==============================================================================
+#if defined (__SANITIZE_THREAD__) || RING_BUFFER_STRESS_TSAN
+/** The ring copies samples while the writer may be overwriting them and only
+    then checks whether they were overwritten, which ThreadSanitizer reports as
+    a race. RingBufferStressTest verifies those copies instead, so they are
+    ignored here. Races on anything else, including the ring's counters, are
+    reported.
+ */
+extern "C" const char* __tsan_default_suppressions()
+{
+    return "race:SampleFormats::*::encode\n"
+           "race:SampleFormats::*::decode\n"
+           "race:SampleFormats::*::add\n"
+           "race:RingBuffer*::copyIntoRing\n"
+           "race:RingBuffer*ReadView::copyChannelTo\n"
+           "race:RingBuffer*ReadView::addChannelTo\n";
+}
+#endif
+
 //==============================================================================
 // This macro generates the main() routine that launches the app.
 START_JUCE_APPLICATION (_3DAudioVisualizersApplication)
@@ -104,9 +104,23 @@ public:
         // Setup Audio Source
         audioTransportSource.prepareToPlay (samplesPerBlockExpected, sampleRate);
         
+        // Lets the visualizers line up what they draw with what is heard. A
+        // block is written when the device asks for it, so it also waits for
+        // the block ahead of it to play out on top of the reported latency.
+        int latencySamples = samplesPerBlockExpected;
+        
+        if (AudioIODevice* device = deviceManager.getCurrentAudioDevice())
+            latencySamples += device->getOutputLatencyInSamples();
+        
         // Setup Ring Buffer of GLfloat's for the visualizer to use
-        // Uses two channels
-        ringBuffer = new RingBuffer<GLfloat> (2, samplesPerBlockExpected * 10);
+        // Uses two channels, the size is rounded up to a power of two. The
+        // oscilloscopes' longest window ends latencySamples behind the newest
+        // sample, and a few blocks more leave the writer room while it's read.
+        const int ringBufferSize = jmax (Oscilloscope2D::maxWindowSize, Oscilloscope3D::maxWindowSize)
+                                     + latencySamples + 4 * samplesPerBlockExpected;
+        
+        ringBuffer = new VisualizerRingBuffer (2, ringBufferSize);
+        ringBuffer->setTiming (sampleRate, latencySamples, samplesPerBlockExpected);
         
         
         // Allocate all Visualizers
@@ -117,7 +131,8 @@ public:
         oscilloscope3D = new Oscilloscope3D (ringBuffer);
         addChildComponent (oscilloscope3D);
         
-        spectrum = new Spectrum (ringBuffer);
+        // The ring is always stereo, so show both channels
+        spectrum = new Spectrum (ringBuffer, SpectrumAnalyser::ChannelLayout::stereoSplit);
         addChildComponent (spectrum);
     }
     
@@ -147,7 +162,24 @@ public:
             delete spectrum;
         }
         
+        // Each visualizer frees its GL objects as its context closes, so none
+        // should be left once they're all deleted
+        DBG ("GL objects alive: " << GLBuffer::getNumLive() << " buffers, "
+             << GLVertexArray::getNumLive() << " vertex arrays, "
+             << GLTexture::getNumLive() << " textures");
+        jassert (GLBuffer::getNumLive() == 0 && GLVertexArray::getNumLive() == 0
+                  && GLTexture::getNumLive() == 0);
+        
         audioTransportSource.releaseResources();
+        
+        // Log how well the visualizers kept up with the audio. This goes to the
+        // Logger rather than DBG, so release builds report it too.
+        const auto telemetry = ringBuffer->getTelemetry();
+        Logger::writeToLog ("RingBuffer: " + String (telemetry.samplesWritten) + " samples written, "
+                            + String (telemetry.overlapEvents) + " overlapped reads, consumer lag "
+                            + String (telemetry.lastReadLag) + " (max " + String (telemetry.maxReadLag) + ") samples, "
+                            + String (telemetry.clampedLookups) + " clamped time lookups");
+        
         delete ringBuffer;
     }
     
@@ -155,6 +187,9 @@ public:
     */
     void getNextAudioBlock (const AudioSourceChannelInfo& bufferToFill) override
     {
+        // Taken first, so the stamp isn't delayed by reading the file
+        const int64 callbackTicks = Time::getHighResolutionTicks();
+        
         // If no mode is enabled, do not mess with audio
         if (!audioFileModeEnabled && !audioInputModeEnabled)
         {
@@ -166,7 +201,8 @@ public:
             audioTransportSource.getNextAudioBlock (bufferToFill);
         
         // Write to Ring Buffer
-        ringBuffer->writeSamples (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples);
+        ringBuffer->writeSamples (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples,
+                                  callbackTicks);
         
         // If using mic input, clear the output so the mic input is not audible
         if (audioInputModeEnabled)
@@ -488,7 +524,7 @@ private:
     AudioTransportState audioTransportState;
     
     // Audio & GL Audio Buffer
-    RingBuffer<float> * ringBuffer;
+    VisualizerRingBuffer * ringBuffer;
     
     // Visualizers
     Oscilloscope2D * oscilloscope2D;
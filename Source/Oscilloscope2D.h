@@ -9,6 +9,7 @@
 #pragma once
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "GLResources.h"
 #include "RingBuffer.h"
 
 /** This 2D Oscilloscope uses a Fragment-Shader based implementation.
@@ -28,8 +29,10 @@ class Oscilloscope2D :  public Component,
     
 public:
     
-    Oscilloscope2D (RingBuffer<GLfloat> * ringBuffer)
-    : readBuffer (2, RING_BUFFER_READ_SIZE)
+    /** The most samples setWindowSize() takes. */
+    static constexpr int maxWindowSize = 8192;
+    
+    Oscilloscope2D (VisualizerRingBuffer * ringBuffer)
     {
         // Sets the OpenGL version to 3.2
         openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
@@ -66,6 +69,7 @@ public:
     
     void start()
     {
+        frameClock.reset();
         openGLContext.setContinuousRepainting (true);
     }
     
@@ -74,6 +78,15 @@ public:
         openGLContext.setContinuousRepainting (false);
     }
     
+    /** Sets how many of the latest samples are shown across the view, from 2
+        to maxWindowSize. Can be called while running. Windows longer than the
+        ring buffer can serve intact, see getMaxTimedReadSize(), are cut short.
+     */
+    void setWindowSize (int numSamples)
+    {
+        windowSize = jmin (jlimit (2, maxWindowSize, numSamples), ringBuffer->getMaxTimedReadSize());
+    }
+    
     
     //==========================================================================
     // OpenGL Callbacks
@@ -88,8 +101,14 @@ public:
         createShaders();
         
         // Setup Buffer Objects
-        openGLContext.extensions.glGenBuffers (1, &VBO); // Vertex Buffer Object
-        openGLContext.extensions.glGenBuffers (1, &EBO); // Element Buffer Object
+        initializeViewPlane();
+        
+        // The samples are read by the shader from a buffer texture
+        if (! sampleBuffer.create (openGLContext, maxWindowSize))
+        {
+            statusText += "\nBuffer textures are not supported";
+            triggerAsyncUpdate();
+        }
     }
     
     /** Called when done rendering OpenGL, as an OpenGLContext object is closing.
@@ -97,8 +116,13 @@ public:
      */
     void openGLContextClosing() override
     {
-        shader.release();
-        uniforms.release();
+        uniforms.reset();
+        shader.reset();
+        
+        VAO.release();
+        VBO.release();
+        EBO.release();
+        sampleBuffer.release();
     }
     
     
@@ -128,68 +152,40 @@ public:
             uniforms->resolution->set ((GLfloat) renderingScale * getWidth(), (GLfloat) renderingScale * getHeight());
         
         // Read in samples from ring buffer
-        if (uniforms->audioSampleData != nullptr)
+        if (uniforms->audioSampleData != nullptr && sampleBuffer.isValid())
         {
-            ringBuffer->readSamples (readBuffer, RING_BUFFER_READ_SIZE);
+            // Show the samples that will be heard when this frame is shown
+            frameClock.startFrame();
+            const int64 presentIndex = ringBuffer->getSampleIndexAtTime (frameClock.getPresentTicks());
             
-            FloatVectorOperations::clear (visualizationBuffer, RING_BUFFER_READ_SIZE);
+            // The window has to fit in the part of the ring the writer isn't
+            // about to overwrite
+            const int numSamples = jmin (windowSize.load(), ringBuffer->getMaxTimedReadSize());
             
-            // Sum channels together
-            for (int i = 0; i < 2; ++i)
+            // Sum channels together, straight out of the ring buffer. A window
+            // that was overwritten while it was read is torn, so keep showing
+            // the last intact one instead.
+            if (ringBuffer->readSummedAt (visualizationBuffer, presentIndex, numSamples))
             {
-                FloatVectorOperations::add (visualizationBuffer, readBuffer.getReadPointer(i, 0), RING_BUFFER_READ_SIZE);
+                // Only the samples shown are uploaded
+                sampleBuffer.update (visualizationBuffer, numSamples);
+                numUploadedSamples = numSamples;
             }
             
-            uniforms->audioSampleData->set (visualizationBuffer, 256);
+            sampleBuffer.bind (0);
+            uniforms->audioSampleData->set ((GLint) 0);
+            
+            if (uniforms->numSamples != nullptr)
+                uniforms->numSamples->set ((GLint) numUploadedSamples);
         }
         
-        // Define Vertices for a Square (the view plane)
-        GLfloat vertices[] = {
-            1.0f,   1.0f,  0.0f,  // Top Right
-            1.0f,  -1.0f,  0.0f,  // Bottom Right
-            -1.0f, -1.0f,  0.0f,  // Bottom Left
-            -1.0f,  1.0f,  0.0f   // Top Left
-        };
-        // Define Which Vertex Indexes Make the Square
-        GLuint indices[] = {  // Note that we start from 0!
-            0, 1, 3,   // First Triangle
-            1, 2, 3    // Second Triangle
-        };
-        
-        // Vertex Array Object stuff for later
-        //openGLContext.extensions.glGenVertexArrays(1, &VAO);
-        //openGLContext.extensions.glBindVertexArray(VAO);
-        
-        // VBO (Vertex Buffer Object) - Bind and Write to Buffer
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, VBO);
-        openGLContext.extensions.glBufferData (GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STREAM_DRAW);
-                                                                    // GL_DYNAMIC_DRAW or GL_STREAM_DRAW
-                                                                    // Don't we want GL_DYNAMIC_DRAW since this
-                                                                    // vertex data will be changing alot??
-                                                                    // test this
-        
-        // EBO (Element Buffer Object) - Bind and Write to Buffer
-        openGLContext.extensions.glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, EBO);
-        openGLContext.extensions.glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STREAM_DRAW);
-                                                                    // GL_DYNAMIC_DRAW or GL_STREAM_DRAW
-                                                                    // Don't we want GL_DYNAMIC_DRAW since this
-                                                                    // vertex data will be changing alot??
-                                                                    // test this
-        
-        // Setup Vertex Attributes
-        openGLContext.extensions.glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
-        openGLContext.extensions.glEnableVertexAttribArray (0);
-    
-        // Draw Vertices
-        //glDrawArrays (GL_TRIANGLES, 0, 6); // For just VBO's (Vertex Buffer Objects)
+        // Draw the view plane, the fragment shader draws the wave onto it
+        VAO.bind();
         glDrawElements (GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0); // For EBO's (Element Buffer Objects) (Indices)
         
-    
-        
-        // Reset the element buffers so child Components draw correctly
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, 0);
-        openGLContext.extensions.glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
-        //openGLContext.extensions.glBindVertexArray(0);
+        // Reset the vertex array and texture so child Components draw correctly
+        VAO.unbind();
+        sampleBuffer.unbind (0);
     }
     
     
@@ -210,6 +206,44 @@ private:
     //==========================================================================
     // OpenGL Functions
     
+    /** Uploads the square the wave is drawn on. It covers the whole view and
+        never changes, so its VAO is set up once here.
+     */
+    void initializeViewPlane()
+    {
+        // Define Vertices for a Square (the view plane)
+        const GLfloat vertices[] = {
+            1.0f,   1.0f,  0.0f,  // Top Right
+            1.0f,  -1.0f,  0.0f,  // Bottom Right
+            -1.0f, -1.0f,  0.0f,  // Bottom Left
+            -1.0f,  1.0f,  0.0f   // Top Left
+        };
+        // Define Which Vertex Indexes Make the Square
+        const GLuint indices[] = {  // Note that we start from 0!
+            0, 1, 3,   // First Triangle
+            1, 2, 3    // Second Triangle
+        };
+        
+        VAO.create (openGLContext);
+        VAO.bind();
+        
+        // VBO (Vertex Buffer Object) - Bind and Write to Buffer
+        VBO.create (openGLContext, GL_ARRAY_BUFFER);
+        VBO.upload (vertices, sizeof(vertices), GL_STATIC_DRAW);
+        
+        // EBO (Element Buffer Object) - Bind and Write to Buffer
+        EBO.create (openGLContext, GL_ELEMENT_ARRAY_BUFFER);
+        EBO.upload (indices, sizeof(indices), GL_STATIC_DRAW);
+        
+        // Setup Vertex Attributes
+        openGLContext.extensions.glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        openGLContext.extensions.glEnableVertexAttribArray (0);
+        
+        // Unbind the VAO first, so it keeps its element buffer
+        VAO.unbind();
+        VBO.unbind();
+        EBO.unbind();
+    }
     
     /** Loads the OpenGL Shaders and sets up the whole ShaderProgram
     */
@@ -225,15 +259,17 @@ private:
         
         fragmentShader =
         "uniform vec2  resolution;\n"
-        "uniform float audioSampleData[256];\n"
+        "uniform samplerBuffer audioSampleData;\n"
+        "uniform int   numSamples;\n"
         "\n"
         "void getAmplitudeForXPos (in float xPos, out float audioAmplitude)\n"
         "{\n"
         // Buffer size - 1
-        "   float perfectSamplePosition = 255.0 * xPos / resolution.x;\n"
+        "   float perfectSamplePosition = float (numSamples - 1) * xPos / resolution.x;\n"
         "   int leftSampleIndex = int (floor (perfectSamplePosition));\n"
         "   int rightSampleIndex = int (ceil (perfectSamplePosition));\n"
-        "   audioAmplitude = mix (audioSampleData[leftSampleIndex], audioSampleData[rightSampleIndex], fract (perfectSamplePosition));\n"
+        "   audioAmplitude = mix (texelFetch (audioSampleData, leftSampleIndex).r,\n"
+        "                         texelFetch (audioSampleData, rightSampleIndex).r, fract (perfectSamplePosition));\n"
         "}\n"
         "\n"
         "#define THICKNESS 0.02\n"
@@ -257,7 +293,7 @@ private:
             && shaderProgramAttempt->addFragmentShader (OpenGLHelpers::translateFragmentShaderToV3 (fragmentShader))
             && shaderProgramAttempt->link())
         {
-            uniforms.release();
+            uniforms.reset();
             shader = std::move (shaderProgramAttempt);
             uniforms.reset (new Uniforms (openGLContext, *shader));
             
@@ -283,12 +319,13 @@ private:
             
             resolution.reset (createUniform (openGLContext, shaderProgram, "resolution"));
             audioSampleData.reset (createUniform (openGLContext, shaderProgram, "audioSampleData"));
-            
+            numSamples.reset (createUniform (openGLContext, shaderProgram, "numSamples"));
+        
         }
         
         //ScopedPointer<OpenGLShaderProgram::Uniform> projectionMatrix, viewMatrix;
-        std::unique_ptr<OpenGLShaderProgram::Uniform> resolution, audioSampleData;
-        
+        std::unique_ptr<OpenGLShaderProgram::Uniform> resolution, audioSampleData, numSamples;
+    
     private:
         static OpenGLShaderProgram::Uniform* createUniform (OpenGLContext& openGLContext,
                                                             OpenGLShaderProgram& shaderProgram,
@@ -304,7 +341,9 @@ private:
     
     // OpenGL Variables
     OpenGLContext openGLContext;
-    GLuint VBO, VAO, EBO;
+    GLVertexArray VAO;
+    GLBuffer VBO, EBO;
+    GLSampleBuffer sampleBuffer;
     
     std::unique_ptr<OpenGLShaderProgram> shader;
     std::unique_ptr<Uniforms> uniforms;
@@ -314,9 +353,11 @@ private:
 
     
     // Audio Buffer
-    RingBuffer<GLfloat> * ringBuffer;
-    AudioBuffer<GLfloat> readBuffer;    // Stores data read from ring buffer
-    GLfloat visualizationBuffer [RING_BUFFER_READ_SIZE];    // Single channel to visualize
+    VisualizerRingBuffer * ringBuffer;
+    GLfloat visualizationBuffer [maxWindowSize];    // Single channel to visualize
+    std::atomic<int> windowSize { RING_BUFFER_READ_SIZE };
+    int numUploadedSamples = 0;                 // The window in the sample buffer
+    FramePresentationClock frameClock;          // Predicts when each frame is shown, reset by start()
     
     
     
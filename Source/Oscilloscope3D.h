@@ -9,8 +9,20 @@
 #pragma once
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "GLResources.h"
 #include "RingBuffer.h"
 #include <fstream>
+#include <vector>
+
+// Geometry shaders are core in OpenGL 3.2, but not every platform's headers
+// name their limits
+#ifndef GL_MAX_GEOMETRY_OUTPUT_VERTICES
+ #define GL_MAX_GEOMETRY_OUTPUT_VERTICES 0x8DE0
+#endif
+
+#ifndef GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS
+ #define GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS 0x8DE1
+#endif
 
 /** This Oscilloscope uses a Geometry-Shader based implementation. It stores a
     heavy ammount of variables on the GPU and does the majority of its
@@ -18,6 +30,26 @@
     CPU to get the visualization to startup faster, but it was cool learning how
     the geomatry shader worked, allowing me to generate new points and calculate
     their positions on the GPU.
+    
+    By default the tube is drawn from a static mesh instead: every slice's ring
+    of vertices is built once, and the vertex shader only moves each slice up
+    or down by its sample. That's one small upload and one indexed draw per
+    frame, and avoids geometry shaders with large outputs, which are slow on
+    many drivers. The geometry shader is still used if the mesh shader fails to
+    compile, or if asked for with setTubeRenderer().
+    
+    Either way, the samples are read from a buffer texture, so the window
+    shown along the tube can be thousands of samples long, see setWindowSize().
+    
+    The tube has several levels of detail, each with its own mesh and geometry
+    shader, all built when the context is created. Every frame draws the one
+    that suits the tube's size on screen, with less detail while frames run
+    late, see setTubeDetail().
+    
+    The mesh also draws a trail of past windows receding behind the newest,
+    like the Spectrum's history. The windows are kept side by side in the
+    sample buffer as a circular history, so each frame uploads only the
+    newest, and the whole trail is one instanced draw, see setHistoryLength().
  */
 
 #define RING_BUFFER_READ_SIZE 256
@@ -29,8 +61,26 @@ class Oscilloscope3D :  public Component,
     
 public:
     
-    Oscilloscope3D (RingBuffer<GLfloat> * ringBuffer)
-    : readBuffer (2, RING_BUFFER_READ_SIZE)
+    /** How the tube is generated. */
+    enum class TubeRenderer
+    {
+        mesh,               // A static mesh, moved by the vertex shader
+        geometryShader      // Generated from scratch by a geometry shader every frame
+    };
+    
+    /** The most samples setWindowSize() takes. */
+    static constexpr int maxWindowSize = 8192;
+    
+    /** The number of levels setTubeDetail() takes, from 0, the cheapest. */
+    static constexpr int numTubeDetails = 5;
+    
+    /** Lets the tube's detail follow its size on screen and the frame time. */
+    static constexpr int automaticTubeDetail = -1;
+    
+    /** The most past windows setHistoryLength() takes. */
+    static constexpr int maxHistoryLength = 64;
+    
+    Oscilloscope3D (VisualizerRingBuffer * ringBuffer)
     {
         // Sets the OpenGL version to 3.2
         openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
@@ -70,6 +120,7 @@ public:
     
     void start()
     {
+        frameClock.reset();
         openGLContext.setContinuousRepainting (true);
     }
     
@@ -78,6 +129,48 @@ public:
         openGLContext.setContinuousRepainting (false);
     }
     
+    /** Chooses how the tube is generated. Can be called while running. */
+    void setTubeRenderer (TubeRenderer newTubeRenderer)
+    {
+        tubeRenderer = newTubeRenderer;
+    }
+    
+    /** Sets how many of the latest samples are shown along the tube, from 2
+        to maxWindowSize. Can be called while running. Windows longer than the
+        ring buffer can serve intact, see getMaxTimedReadSize(), are cut short.
+     */
+    void setWindowSize (int numSamples)
+    {
+        windowSize = jmin (jlimit (2, maxWindowSize, numSamples), ringBuffer->getMaxTimedReadSize());
+    }
+    
+    /** Fixes the tube's detail to a level below numTubeDetails, or lets it
+        follow the tube's size on screen and the frame time with
+        automaticTubeDetail, the default. Can be called while running.
+     */
+    void setTubeDetail (int detailLevel)
+    {
+        tubeDetail = detailLevel < 0 ? automaticTubeDetail : jmin (detailLevel, numTubeDetails - 1);
+    }
+    
+    /** Sets the frame time the automatic detail keeps under, 20ms by default,
+        which 60Hz displays stay inside. Raise it for slower displays.
+     */
+    void setFrameTimeBudget (double seconds)
+    {
+        frameBudgetSeconds = jmax (0.001, seconds);
+    }
+    
+    /** Sets how many windows are drawn, the newest in front and the older
+        ones receding behind it, up to maxHistoryLength, or fewer if the
+        driver's buffer textures can't hold that many. 1 draws only the
+        newest. Can be called while running.
+     */
+    void setHistoryLength (int numWindows)
+    {
+        historyLength = jlimit (1, maxHistoryLength, numWindows);
+    }
+    
     
     //==========================================================================
     // OpenGL Callbacks
@@ -88,11 +181,41 @@ public:
      */
     void newOpenGLContextCreated() override
     {
-        // Setup Shaders
+        // The whole history has to fit in one buffer texture. Keep as many
+        // windows as fit, and shorten the windows if not even one does.
+        const int maxSampleBufferSize = GLSampleBuffer::getMaxCapacity();
+        historyRowStride = jlimit (2, maxWindowSize, maxSampleBufferSize);
+        historyCapacity = jlimit (1, maxHistoryLength, maxSampleBufferSize / historyRowStride);
+        
+        // Setup Shaders, which need the history's size
         createShaders();
         
-        // Setup Buffer Objects
-        openGLContext.extensions.glGenBuffers (1, &VBO); // Vertex Buffer Object
+        // Setup the single point the geometry shader grows the tube from
+        initializePointVertex();
+        
+        // Setup the static tube meshes, one for every level of detail
+        for (int detail = 0; detail < numTubeDetails; ++detail)
+            initializeTubeMesh (detail);
+        
+        // The samples are read by the shaders from a buffer texture, which
+        // holds the history of windows one after another
+        if (! sampleBuffer.create (openGLContext, historyRowStride * historyCapacity))
+        {
+            statusText += "\nBuffer textures are not supported";
+            triggerAsyncUpdate();
+        }
+        else if (historyCapacity < maxHistoryLength || historyRowStride < maxWindowSize)
+        {
+            statusText << "\nHistory: " << historyCapacity << " windows of " << historyRowStride
+                       << " samples, buffer textures hold " << maxSampleBufferSize;
+            triggerAsyncUpdate();
+        }
+        
+        historyHead = 0;
+        
+        // glDrawElementsInstanced() isn't one of JUCE's extension functions.
+        // Without it, only the newest window is drawn.
+        drawElementsInstanced = (DrawElementsInstancedFunction) OpenGLHelpers::getExtensionFunction ("glDrawElementsInstanced");
     }
     
     /** Called when done rendering OpenGL, as an OpenGLContext object is closing.
@@ -100,8 +223,22 @@ public:
      */
     void openGLContextClosing() override
     {
-        waveShader.release();
-        uniforms.release();
+        meshUniforms.reset();
+        meshShader.reset();
+        
+        for (auto& variant : tubeVariants)
+        {
+            variant.uniforms.reset();
+            variant.waveShader.reset();
+            
+            variant.meshVAO.release();
+            variant.meshVBO.release();
+            variant.meshEBO.release();
+        }
+        
+        pointVAO.release();
+        pointVBO.release();
+        sampleBuffer.release();
     }
     
     
@@ -122,14 +259,33 @@ public:
         glEnable (GL_BLEND);
         glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         
+        // Time this frame, for the tube detail and the window to show
+        frameClock.startFrame();
+        
+        // Use the mesh unless the geometry shader was asked for, and fall back
+        // to whichever compiled
+        const bool useMesh = meshShader != nullptr
+                               && (tubeRenderer == TubeRenderer::mesh || ! hasWaveShader());
+        
+        const TubeVariant& variant = tubeVariants[chooseTubeDetail (useMesh, renderingScale * getWidth(), frameClock.getFrameTicks())];
+        
+        OpenGLShaderProgram* shader = useMesh ? meshShader.get() : variant.waveShader.get();
+        Uniforms* shaderUniforms = useMesh ? meshUniforms.get() : variant.uniforms.get();
+        
+        if (shader == nullptr)
+            return;
+        
         // Use Shader Program that's been defined
-        waveShader->use();
+        shader->use();
         
         // Setup the Uniforms for use in the Shader
-        if (uniforms->projectionMatrix != nullptr)
-            uniforms->projectionMatrix->setMatrix4 (getProjectionMatrix().mat, 1, false);
+        if (shaderUniforms->projectionMatrix != nullptr)
+            shaderUniforms->projectionMatrix->setMatrix4 (getProjectionMatrix().mat, 1, false);
+        
+        if (shaderUniforms->amplitudeScale != nullptr)
+            shaderUniforms->amplitudeScale->set (waveRenderingHeight / 2.0f);
         
-        if (uniforms->viewMatrix != nullptr)
+        if (shaderUniforms->viewMatrix != nullptr)
         {
             // Scale and view matrix
             Matrix3D<float> scale;
@@ -137,7 +293,7 @@ public:
             scale.mat[5] = 2.0;
             scale.mat[10] = 2.0;
             Matrix3D<float> finalMatrix = scale * getViewMatrix();
-            uniforms->viewMatrix->setMatrix4 (finalMatrix.mat, 1, false);
+            shaderUniforms->viewMatrix->setMatrix4 (finalMatrix.mat, 1, false);
             
         }
         
@@ -146,51 +302,76 @@ public:
             // uniforms->resolution->set ((GLfloat) 100.0, (GLfloat) 100.0);
         
         // Read in audio samples from ring buffer
-        if (uniforms->audioSampleData != nullptr)
+        if (shaderUniforms->audioSampleData != nullptr && sampleBuffer.isValid())
         {
-            ringBuffer->readSamples (readBuffer, RING_BUFFER_READ_SIZE);
+            // Show the samples that will be heard when this frame is shown
+            const int64 presentIndex = ringBuffer->getSampleIndexAtTime (frameClock.getPresentTicks());
             
-            FloatVectorOperations::clear (visualizationBuffer, RING_BUFFER_READ_SIZE);
+            // The window has to fit in the part of the ring the writer isn't
+            // about to overwrite
+            const int numSamples = jmin (windowSize.load(), ringBuffer->getMaxTimedReadSize(), historyRowStride);
             
-            // Sum channels together
-            for (int i = 0; i < 2; ++i)
+            // Sum channels together, straight out of the ring buffer. A window
+            // that was overwritten while it was read is torn, so the history
+            // stays as it is for this frame.
+            if (ringBuffer->readSummedAt (visualizationBuffer, presentIndex, numSamples))
             {
-                FloatVectorOperations::add (visualizationBuffer, readBuffer.getReadPointer(i, 0), RING_BUFFER_READ_SIZE);
+                // The new window replaces the oldest one, which becomes the head.
+                // Only its samples are uploaded, the shader moves the others back.
+                historyHead = (historyHead + historyCapacity - 1) % historyCapacity;
+                sampleBuffer.update (visualizationBuffer, numSamples, historyHead * historyRowStride);
+                numUploadedSamples = numSamples;
             }
             
-            uniforms->audioSampleData->set (visualizationBuffer, 256);
+            sampleBuffer.bind (0);
+            shaderUniforms->audioSampleData->set ((GLint) 0);
+            
+            if (shaderUniforms->numSamples != nullptr)
+                shaderUniforms->numSamples->set ((GLint) numUploadedSamples);
         }
         
-        // Define Origin or Object 0.0
-        GLfloat vertices[] = { 0.0f, 0.0f, 0.0f };
+        // The mesh draws the whole history, the geometry shader only the head
+        const int numHistoryRows = useMesh && drawElementsInstanced != nullptr
+                                     ? jmin (historyLength.load(), historyCapacity) : 1;
         
+        if (shaderUniforms->historyHead != nullptr)
+            shaderUniforms->historyHead->set ((GLint) historyHead);
         
-        // Vertex Array Object stuff for later
-        openGLContext.extensions.glGenVertexArrays (1, &VAO);
-        openGLContext.extensions.glBindVertexArray (VAO);
+        if (shaderUniforms->historyRowStride != nullptr)
+            shaderUniforms->historyRowStride->set ((GLint) historyRowStride);
         
-        // VBO (Vertex Buffer Object) - Bind and Write to Buffer
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, VBO);
-        openGLContext.extensions.glBufferData (GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-                                                                    // Other options are GL_DYNAMIC_DRAW or
-                                                                    // GL_STREAM_DRAW but we want STATIC because
-                                                                    // we are only feeding OpenGL a static, single
-                                                                    // point. The Geo Shader generates all the
-                                                                    // changing data, but this GL_ARRAY_BUFFER
-                                                                    // is unchanged.
+        if (shaderUniforms->numHistoryRows != nullptr)
+            shaderUniforms->numHistoryRows->set ((GLint) numHistoryRows);
         
+        if (shaderUniforms->historyRowSpacing != nullptr)
+            shaderUniforms->historyRowSpacing->set (historyDepth / numHistoryRows);
+        
+        if (useMesh)
+        {
+            // The whole tube in one draw, the shader moves the slices. Every
+            // instance is one window of the history, newest first, so the
+            // depth test hides the older ones behind it.
+            glEnable (GL_DEPTH_TEST);
+            variant.meshVAO.bind();
+            
+            if (numHistoryRows > 1)
+                drawElementsInstanced (GL_TRIANGLES, variant.numMeshIndices, GL_UNSIGNED_INT, nullptr, numHistoryRows);
+            else
+                glDrawElements (GL_TRIANGLES, variant.numMeshIndices, GL_UNSIGNED_INT, nullptr);
+            
+            variant.meshVAO.unbind();
+            glDisable (GL_DEPTH_TEST);
+            sampleBuffer.unbind (0);
+            return;
+        }
         
-        // Setup Vertex Attributes (Sets up vertices to work as only x, y values)
-        openGLContext.extensions.glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
-        openGLContext.extensions.glEnableVertexAttribArray (0);
-    
         // Draw Vertices
+        pointVAO.bind();
         glDrawArrays (GL_POINTS, 0, 1); // For just VBO's (Vertex Buffer Objects)
         
-        // Reset the element buffers so child Components draw correctly
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, 0);
-        openGLContext.extensions.glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
-        openGLContext.extensions.glBindVertexArray (0);
+        // Reset the vertex array and texture so child Components draw correctly
+        pointVAO.unbind();
+        sampleBuffer.unbind (0);
     }
     
     
@@ -217,6 +398,197 @@ public:
     
 private:
     
+    /** The tube's resolution at one level of detail. */
+    struct TubeDetail
+    {
+        int widthResolution;    // Slices along the tube
+        int girthResolution;    // Vertices around each slice
+    };
+    
+    static constexpr TubeDetail tubeDetails[numTubeDetails] = {
+        { 24, 4 }, { 50, 5 }, { 100, 8 }, { 200, 12 }, { 400, 16 }
+    };
+    
+    // The geometry shader only outputs gl_Position
+    static constexpr int waveGeometryComponentsPerVertex = 4;
+    
+    //==========================================================================
+    // Mesh Functions
+    
+    /** Builds the tube's mesh for one level of detail and uploads it once.
+    
+        Every slice is a ring of girthResolution vertices around the wave's
+        centre line, and neighbouring rings are joined by two triangles per
+        side. Each vertex also stores where its slice is along the window of
+        samples, from 0 to 1, which the vertex shader uses to move it.
+     */
+    void initializeTubeMesh (int detail)
+    {
+        const int waveWidthResolution = tubeDetails[detail].widthResolution;
+        const int waveGirthResolution = tubeDetails[detail].girthResolution;
+        TubeVariant& variant = tubeVariants[detail];
+        
+        const int numVertices = waveWidthResolution * waveGirthResolution;
+        const GLfloat slicePositionOffset = waveRenderingWidth / (waveWidthResolution - 1.0f);
+        const GLfloat sampleOffset = 1.0f / (waveWidthResolution - 1.0f);
+        const GLfloat girthAngleOffset = MathConstants<float>::twoPi / waveGirthResolution;
+        
+        // x, y and z around the centre line, then the sample position
+        std::vector<GLfloat> vertices;
+        vertices.reserve ((size_t) numVertices * 4);
+        
+        for (int slice = 0; slice < waveWidthResolution; ++slice)
+        {
+            for (int girth = 0; girth < waveGirthResolution; ++girth)
+            {
+                vertices.push_back (slice * slicePositionOffset - waveRenderingWidth / 2.0f);
+                vertices.push_back (waveRadius * std::sin (girth * girthAngleOffset));
+                vertices.push_back (waveRadius * std::cos (girth * girthAngleOffset));
+                vertices.push_back (slice * sampleOffset);
+            }
+        }
+        
+        std::vector<GLuint> indices;
+        indices.reserve ((size_t) ((waveWidthResolution - 1) * waveGirthResolution * 6));
+        
+        for (int slice = 0; slice < waveWidthResolution - 1; ++slice)
+        {
+            for (int girth = 0; girth < waveGirthResolution; ++girth)
+            {
+                const int nextGirth = (girth + 1) % waveGirthResolution;
+                
+                const GLuint a = (GLuint) (slice * waveGirthResolution + girth);
+                const GLuint b = (GLuint) (slice * waveGirthResolution + nextGirth);
+                const GLuint c = a + (GLuint) waveGirthResolution;
+                const GLuint d = b + (GLuint) waveGirthResolution;
+                
+                indices.insert (indices.end(), { a, c, b, b, c, d });
+            }
+        }
+        
+        variant.numMeshIndices = (int) indices.size();
+        
+        variant.meshVAO.create (openGLContext);
+        variant.meshVAO.bind();
+        
+        variant.meshVBO.create (openGLContext, GL_ARRAY_BUFFER);
+        variant.meshVBO.upload (vertices.data(), sizeof(GLfloat) * vertices.size(), GL_STATIC_DRAW);
+        
+        variant.meshEBO.create (openGLContext, GL_ELEMENT_ARRAY_BUFFER);
+        variant.meshEBO.upload (indices.data(), sizeof(GLuint) * indices.size(), GL_STATIC_DRAW);
+        
+        openGLContext.extensions.glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*) 0);
+        openGLContext.extensions.glEnableVertexAttribArray (0);
+        openGLContext.extensions.glVertexAttribPointer (1, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*) (3 * sizeof(GLfloat)));
+        openGLContext.extensions.glEnableVertexAttribArray (1);
+        
+        // Unbind the VAO first, so it keeps its element buffer
+        variant.meshVAO.unbind();
+        variant.meshVBO.unbind();
+        variant.meshEBO.unbind();
+    }
+    
+    /** Uploads the origin, the one point the geometry shader draws the whole
+        tube from. It never changes, so its VAO is set up once here.
+     */
+    void initializePointVertex()
+    {
+        const GLfloat vertices[] = { 0.0f, 0.0f, 0.0f };
+        
+        pointVAO.create (openGLContext);
+        pointVAO.bind();
+        
+        pointVBO.create (openGLContext, GL_ARRAY_BUFFER);
+        pointVBO.upload (vertices, sizeof(vertices), GL_STATIC_DRAW);
+        
+        // Setup Vertex Attributes
+        openGLContext.extensions.glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        openGLContext.extensions.glEnableVertexAttribArray (0);
+        
+        pointVAO.unbind();
+        pointVBO.unbind();
+    }
+    
+    
+    //==========================================================================
+    // Level of Detail
+    
+    /** Returns true if a geometry shader compiled for any level of detail. */
+    bool hasWaveShader() const
+    {
+        for (auto& variant : tubeVariants)
+            if (variant.waveShader != nullptr)
+                return true;
+        
+        return false;
+    }
+    
+    /** Picks the level of detail to draw this frame.
+    
+        The tube spans nearly the whole width of the view, so the level is the
+        one with about one slice every pixelsPerSlice pixels. That is limited
+        by the frame time: the limit drops a level soon after frames take
+        longer than the budget, and goes back up only after a long run of fast
+        frames, so the tube doesn't flicker between two levels.
+        
+        @param useMesh      false if drawing with the geometry shader, which
+                            may not have compiled for every level
+        @param pixelWidth   the width of the view in physical pixels
+        @param frameTicks   how long the last frame took
+     */
+    int chooseTubeDetail (bool useMesh, float pixelWidth, int64 frameTicks)
+    {
+        // Follow the frame time slowly, so one late frame doesn't count
+        if (frameTicks > 0)
+            smoothedFrameSeconds += 0.05 * (Time::highResolutionTicksToSeconds (frameTicks) - smoothedFrameSeconds);
+        
+        const double budget = frameBudgetSeconds.load();
+        
+        // Only count as far as either change needs, so that a long session
+        // can't overflow the count
+        framesAtDetailLimit = jmin (framesAtDetailLimit + 1, jmax (framesBeforeLowering, framesBeforeRaising) + 1);
+        
+        if (smoothedFrameSeconds > budget && detailLimit > 0
+            && framesAtDetailLimit > framesBeforeLowering)
+        {
+            --detailLimit;
+            framesAtDetailLimit = 0;
+        }
+        else if (smoothedFrameSeconds < 0.9 * budget && detailLimit < numTubeDetails - 1
+                 && framesAtDetailLimit > framesBeforeRaising)
+        {
+            ++detailLimit;
+            framesAtDetailLimit = 0;
+        }
+        
+        int detail = tubeDetail.load();
+        
+        if (detail == automaticTubeDetail)
+        {
+            detail = 0;
+            
+            while (detail < detailLimit
+                   && tubeDetails[detail + 1].widthResolution * pixelsPerSlice <= pixelWidth)
+                ++detail;
+        }
+        
+        if (useMesh)
+            return detail;
+        
+        // Geometry shaders with many outputs don't compile on every driver, so
+        // use the nearest level that did, preferring cheaper ones
+        for (int cheaper = detail; cheaper >= 0; --cheaper)
+            if (tubeVariants[cheaper].waveShader != nullptr)
+                return cheaper;
+        
+        for (int dearer = detail + 1; dearer < numTubeDetails; ++dearer)
+            if (tubeVariants[dearer].waveShader != nullptr)
+                return dearer;
+        
+        return detail;
+    }
+    
+    
     //==========================================================================
     // OpenGL Functions
     
@@ -251,22 +623,64 @@ private:
         "{\n"
         "    gl_Position = vec4(position, 0.0f, 1.0f);\n"
         "}\n";
+        
+        
+        // Static tube mesh: every vertex is moved up by its slice's sample.
+        // Each instance is one window of the history, gl_InstanceID 0 being
+        // the newest, and is moved back by its age.
+        meshVertexShader =
+        "#version 330 core\n"
+        "layout (location = 0) in vec3 ringPosition;\n"
+        "layout (location = 1) in float samplePosition;\n"
+        
+        // Uniforms
+        "uniform mat4 projectionMatrix;\n"
+        "uniform mat4 viewMatrix;\n"
+        "uniform float amplitudeScale;\n"
+        "uniform samplerBuffer audioSampleData;\n"
+        "uniform int numSamples;\n"
+        "uniform int historyHead;\n"           // The row of the newest window
+        "uniform int historyRowStride;\n"      // Samples from one row to the next
+        "uniform int numHistoryRows;\n"        // Windows drawn
+        "uniform float historyRowSpacing;\n"
+        "\n"
+        "out float brightness;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    int rowStart = ((historyHead + gl_InstanceID) % " + String (historyCapacity) + ") * historyRowStride;\n"
+        "    float perfectSamplePosition = float (numSamples - 1) * samplePosition;\n"
+        "    int leftSampleIndex = rowStart + int (floor (perfectSamplePosition));\n"
+        "    int rightSampleIndex = rowStart + int (ceil (perfectSamplePosition));\n"
+        "    float amplitude = mix (texelFetch (audioSampleData, leftSampleIndex).r,\n"
+        "                           texelFetch (audioSampleData, rightSampleIndex).r, fract (perfectSamplePosition));\n"
+        "    float depth = -historyRowSpacing * float (gl_InstanceID);\n"
+        "    vec3 position = ringPosition + vec3 (0.0f, amplitudeScale * amplitude, depth);\n"
+        "    brightness = 1.0f - float (gl_InstanceID) / float (numHistoryRows);\n"
+        "    gl_Position = projectionMatrix * viewMatrix * vec4 (position, 1.0f);\n"
+        "}\n";
+        
+        // Fades the older windows of the history out
+        meshFragmentShader =
+        "#version 330 core\n"
+        "in float brightness;\n"
+        "out vec4 color;\n"
+        "void main()\n"
+        "{\n"
+        "    color = vec4 (0.0f, 1.0f, 0.0f, brightness);\n"
+        "}\n";
 
         
         // Oscilloscope Triangle Wave Rendering Geometry Shader
         // NOTE: This does inefficiently repeat vertices
-        // When fixing makes sure to pay attention to
-        // layout (triangle_strip, max_vertices = 598) out;
-        // max_vertices needs to be based and calculated from other numbers
+        // The version, resolutions and max_vertices are put in front of it for
+        // every level of detail, see createWaveGeometryShader()
         waveGeometryShader =
-        "#version 330 core\n"
         
         // User Defined Variables
         "#define WAVE_RENDERING_WIDTH 4.0f\n"
         "#define WAVE_RENDERING_HEIGHT 3.0f\n"
-        "#define WAVE_WIDTH_RESOLUTION 50\n"
         "#define WAVE_RADIUS 0.1f\n"
-        "#define WAVE_GIRTH_RESOLUTION 5\n"
         "#define PI 3.1415926538f\n"
         
         // Calculated Data based of User Defined Variables (this might be more inefficient than passing variables to functions)
@@ -275,25 +689,28 @@ private:
         
         // Input / Output
         "layout (points) in;\n"
-        // PROBLEM MY ALGORITHM IS REPEATING VERTICES
-        // !! max_vertices MUST be (WAVE_GIRTH_RESOLUTION * WAVE_WIDTH_RESOLUTION * 2) + 2 * (WAVE_WIDTH_RESOLUTION - 1) cuz of repeated vertices!!
-        "layout (triangle_strip, max_vertices = 598) out;\n"
         
         // Uniforms
         "uniform mat4 projectionMatrix;\n"
         "uniform mat4 viewMatrix;\n"
-        "uniform float audioSampleData[256];\n"
+        "uniform samplerBuffer audioSampleData;\n"
+        "uniform int numSamples;\n"
+        "uniform int historyHead;\n"
+        "uniform int historyRowStride;\n"
         
         /** Gets the amplitude for a given x position of a wave slice.
         */
         "void getAmplitudeForXPos (in float xPos, out float audioAmplitude)\n"
         "{\n"
+            // Only the newest window of the history is drawn
+        "    int rowStart = historyHead * historyRowStride;\n"
         //                                Buffer size - 1
-        "    float perfectSamplePosition = 255.0f * xPos / WAVE_RENDERING_WIDTH;\n"
-        "    int leftSampleIndex = int (floor (perfectSamplePosition));\n"
-        "    int rightSampleIndex = int (ceil (perfectSamplePosition));\n"
+        "    float perfectSamplePosition = float (numSamples - 1) * xPos / WAVE_RENDERING_WIDTH;\n"
+        "    int leftSampleIndex = rowStart + int (floor (perfectSamplePosition));\n"
+        "    int rightSampleIndex = rowStart + int (ceil (perfectSamplePosition));\n"
             // Output the result
-        "    audioAmplitude = mix (audioSampleData[leftSampleIndex], audioSampleData[rightSampleIndex], fract (perfectSamplePosition));\n"
+        "    audioAmplitude = mix (texelFetch (audioSampleData, leftSampleIndex).r,\n"
+        "                          texelFetch (audioSampleData, rightSampleIndex).r, fract (perfectSamplePosition));\n"
         "}\n"
         
         /** Calculates the origin point for a given slice division in the wave,
@@ -449,27 +866,94 @@ private:
         "}\n";
         
         
-        std::unique_ptr<OpenGLShaderProgram> shaderProgramAttempt = std::make_unique<OpenGLShaderProgram> (openGLContext);
+        // Every level of detail is compiled now, so switching is free later.
+        // Levels that emit more than the driver allows are left out, as some
+        // drivers fail to link them and others link them and then fall back
+        // to software. The spec only guarantees 256 vertices and 1024 floats.
+        String geometryShaderError;
+        GLint maxOutputVertices = 0, maxOutputComponents = 0;
+        glGetIntegerv (GL_MAX_GEOMETRY_OUTPUT_VERTICES, &maxOutputVertices);
+        glGetIntegerv (GL_MAX_GEOMETRY_TOTAL_OUTPUT_COMPONENTS, &maxOutputComponents);
         
-        if (shaderProgramAttempt->addVertexShader ((vertexShader))
-            && shaderProgramAttempt->addShader (waveGeometryShader, GL_GEOMETRY_SHADER)
-            && shaderProgramAttempt->addFragmentShader ((fragmentShader))
-            && shaderProgramAttempt->link())
+        for (int detail = 0; detail < numTubeDetails; ++detail)
         {
-            uniforms.reset();
-            waveShader = std::move (shaderProgramAttempt);
-            uniforms = std::make_unique<Uniforms> (openGLContext, *waveShader);
+            const int numOutputVertices = getWaveGeometryVertices (tubeDetails[detail]);
+            
+            if (numOutputVertices > maxOutputVertices
+                || numOutputVertices * waveGeometryComponentsPerVertex > maxOutputComponents)
+            {
+                if (geometryShaderError.isEmpty())
+                    geometryShaderError = "Geometry shader: " + String (numOutputVertices) + " output vertices needed, "
+                                            + String (maxOutputVertices) + " allowed";
+                
+                continue;
+            }
             
+            std::unique_ptr<OpenGLShaderProgram> shaderProgramAttempt = std::make_unique<OpenGLShaderProgram> (openGLContext);
+            
+            if (shaderProgramAttempt->addVertexShader ((vertexShader))
+                && shaderProgramAttempt->addShader (createWaveGeometryShader (tubeDetails[detail]), GL_GEOMETRY_SHADER)
+                && shaderProgramAttempt->addFragmentShader ((fragmentShader))
+                && shaderProgramAttempt->link())
+            {
+                TubeVariant& variant = tubeVariants[detail];
+                variant.uniforms.reset();
+                variant.waveShader = std::move (shaderProgramAttempt);
+                variant.uniforms = std::make_unique<Uniforms> (openGLContext, *variant.waveShader);
+            }
+            else if (geometryShaderError.isEmpty())
+            {
+                geometryShaderError = shaderProgramAttempt->getLastError();
+            }
+        }
+        
+        if (hasWaveShader())
             statusText = "GLSL: v" + String (OpenGLShaderProgram::getLanguageVersion(), 2);
+        else
+            statusText = geometryShaderError;
+        
+        std::unique_ptr<OpenGLShaderProgram> meshShaderAttempt = std::make_unique<OpenGLShaderProgram> (openGLContext);
+        
+        if (meshShaderAttempt->addVertexShader (meshVertexShader)
+            && meshShaderAttempt->addFragmentShader (meshFragmentShader)
+            && meshShaderAttempt->link())
+        {
+            meshUniforms.reset();
+            meshShader = std::move (meshShaderAttempt);
+            meshUniforms = std::make_unique<Uniforms> (openGLContext, *meshShader);
         }
         else
         {
-            statusText = shaderProgramAttempt->getLastError();
+            statusText << "\nMesh: " << meshShaderAttempt->getLastError();
         }
         
         triggerAsyncUpdate();
     }
     
+    /** Returns the most vertices the geometry shader emits for one level of
+        detail.
+    
+        Every pair of slices is one triangle strip of 2 * girthResolution + 2
+        vertices, as the first two are repeated to close the ring, so that
+        many for every pair is the most the shader can emit.
+     */
+    static int getWaveGeometryVertices (const TubeDetail& detail) noexcept
+    {
+        return (detail.widthResolution - 1) * (2 * detail.girthResolution + 2);
+    }
+    
+    /** Returns the geometry shader for one level of detail. */
+    String createWaveGeometryShader (const TubeDetail& detail) const
+    {
+        const int maxVertices = getWaveGeometryVertices (detail);
+        
+        return "#version 330 core\n"
+               "#define WAVE_WIDTH_RESOLUTION " + String (detail.widthResolution) + "\n"
+               "#define WAVE_GIRTH_RESOLUTION " + String (detail.girthResolution) + "\n"
+               "layout (triangle_strip, max_vertices = " + String (maxVertices) + ") out;\n"
+               + waveGeometryShader;
+    }
+    
     //==============================================================================
     // This class manages the uniform values that the shaders use.
     struct Uniforms
@@ -481,11 +965,18 @@ private:
             
             resolution.reset (createUniform (openGLContext, shaderProgram, "resolution"));
             audioSampleData.reset (createUniform (openGLContext, shaderProgram, "audioSampleData"));
-            
+            amplitudeScale.reset (createUniform (openGLContext, shaderProgram, "amplitudeScale"));
+            numSamples.reset (createUniform (openGLContext, shaderProgram, "numSamples"));
+            historyHead.reset (createUniform (openGLContext, shaderProgram, "historyHead"));
+            historyRowStride.reset (createUniform (openGLContext, shaderProgram, "historyRowStride"));
+            numHistoryRows.reset (createUniform (openGLContext, shaderProgram, "numHistoryRows"));
+            historyRowSpacing.reset (createUniform (openGLContext, shaderProgram, "historyRowSpacing"));
+        
         }
         
         std::unique_ptr<OpenGLShaderProgram::Uniform> projectionMatrix, viewMatrix;
-        std::unique_ptr<OpenGLShaderProgram::Uniform> resolution, audioSampleData;
+        std::unique_ptr<OpenGLShaderProgram::Uniform> resolution, audioSampleData, amplitudeScale, numSamples;
+        std::unique_ptr<OpenGLShaderProgram::Uniform> historyHead, historyRowStride, numHistoryRows, historyRowSpacing;
         std::unique_ptr<OpenGLShaderProgram::Uniform> lightPosition;
         
     private:
@@ -503,12 +994,44 @@ private:
     
     // OpenGL Variables
     OpenGLContext openGLContext;
-    GLuint VBO, VAO;/*, EBO;*/
+    GLVertexArray pointVAO;
+    GLBuffer pointVBO;
+    GLSampleBuffer sampleBuffer;
     
-    std::unique_ptr<OpenGLShaderProgram> waveShader;
-    std::unique_ptr<Uniforms> uniforms;
+    // What is drawn for one level of detail: its mesh, see initializeTubeMesh(),
+    // and its geometry shader, if that compiled
+    struct TubeVariant
+    {
+        GLVertexArray meshVAO;
+        GLBuffer meshVBO, meshEBO;
+        int numMeshIndices = 0;
+        std::unique_ptr<OpenGLShaderProgram> waveShader;
+        std::unique_ptr<Uniforms> uniforms;
+    };
+    
+    TubeVariant tubeVariants[numTubeDetails];
+    std::unique_ptr<OpenGLShaderProgram> meshShader;
+    std::unique_ptr<Uniforms> meshUniforms;
+    std::atomic<TubeRenderer> tubeRenderer { TubeRenderer::mesh };
+    
+    // The tube's shape, the same as the #defines in waveGeometryShader
+    static constexpr GLfloat waveRenderingWidth = 4.0f;
+    static constexpr GLfloat waveRenderingHeight = 3.0f;
+    static constexpr GLfloat waveRadius = 0.1f;
+    
+    // Level of Detail, see chooseTubeDetail()
+    std::atomic<int> tubeDetail { automaticTubeDetail };
+    std::atomic<double> frameBudgetSeconds { 0.02 };
+    double smoothedFrameSeconds = 0.0;
+    int detailLimit = numTubeDetails - 1;   // The most detail the frame time allows
+    int framesAtDetailLimit = 0;
+    static constexpr int framesBeforeLowering = 30;
+    static constexpr int framesBeforeRaising = 300;
+    static constexpr float pixelsPerSlice = 8.0f;
     
     const char* vertexShader;
+    String meshVertexShader;
+    const char* meshFragmentShader;
     const char* fragmentShader;
     const char* lightFragmentShader;
     const char* waveGeometryShader;
@@ -517,9 +1040,22 @@ private:
     Draggable3DOrientation draggableOrientation;
     
     // Audio Buffers
-    RingBuffer<GLfloat> * ringBuffer;
-    AudioBuffer<GLfloat> readBuffer;    // Stores data read from ring buffer
-    GLfloat visualizationBuffer [RING_BUFFER_READ_SIZE];    // Single channel to visualize
+    VisualizerRingBuffer * ringBuffer;
+    GLfloat visualizationBuffer [maxWindowSize];    // Single channel to visualize
+    std::atomic<int> windowSize { RING_BUFFER_READ_SIZE };
+    int numUploadedSamples = 0;                     // The newest window in the sample buffer
+    
+    // The history of windows, one row of historyRowStride samples each in
+    // the sample buffer, drawn with one instance per row
+    typedef void (JUCE_GLAPIENTRY* DrawElementsInstancedFunction) (GLenum mode, GLsizei count, GLenum type,
+                                                                   const GLvoid* indices, GLsizei instanceCount);
+    DrawElementsInstancedFunction drawElementsInstanced = nullptr;
+    std::atomic<int> historyLength { 32 };
+    int historyHead = 0;                            // The row holding the newest window
+    int historyCapacity = maxHistoryLength;         // The rows that fit in the sample buffer
+    int historyRowStride = maxWindowSize;           // The samples in one row, fewer if the buffer is small
+    static constexpr GLfloat historyDepth = 4.0f;   // How far back the oldest window is drawn
+    FramePresentationClock frameClock;              // Predicts when each frame is shown, reset by start()
     
     // Overlay GUI
     String statusText;
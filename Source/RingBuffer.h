@@ -8,7 +8,9 @@
 #pragma once
 
 #include "../JuceLibraryCode/JuceHeader.h"
-#include <memory>
+#include "SampleFormats.h"
+#include <atomic>
+#include <cstring>
 
 /** A circular, lock-free buffer for multiple channels of audio.
  
@@ -17,31 +19,100 @@
     Make sure that the number of samples read from the RingBuffer in every
     readSamples() call is less than the bufferSize specified in the constructor.
  
-    Also, ensure that the number of samples read from the RingBuffer at any time
-    plus the number of samples written to the RingBuffer at any time never exceed
-    the buffer size. This prevents read/write overlap.
+    The writer never waits on the readers. Instead, every write is tracked by
+    two monotonically increasing sample counters:
+        
+        - writeClaim:  the index one past the last sample the writer has
+                       started writing (published before the samples are copied)
+        - writeCount:  the index one past the last sample the writer has
+                       finished writing (published after the samples are copied)
+    
+    A reader copies the window that ends at writeCount, then checks writeClaim.
+    If the writer has claimed a sample that lands on top of the window, the
+    window was (possibly) overwritten while it was being copied, and the read
+    is retried. This works like a seqlock, where the counters act as the epoch.
+    
+    Keeping the read size plus the largest write size below the buffer size
+    still avoids overlap entirely, it is just no longer needed for correctness.
+    
+    The buffer size is always rounded up to a power of two, so positions in the
+    ring are found with a mask instead of an integer modulo, and every channel
+    starts on a 64-byte boundary so it can be used with wide vector loads.
+    
+    Readers can either grab the most recent window with readSamples(), or
+    register as a consumer with addConsumer() and receive every sample exactly
+    once through readNewSamples(). Both also have zero-copy versions that give
+    access to the samples in place, see ReadView.
+    
+    The number of channels and the buffer size can optionally be fixed at
+    compile time, e.g. RingBuffer<float, 2, 4096>. The compiler can then unroll
+    the channel loops and fold the wrap-around arithmetic. Leave either one as
+    dynamicSize (the default) to choose it at runtime instead.
+    
+    By default samples are stored as they are written. To save memory and cache
+    bandwidth, a float ring can store them in a compact format instead, e.g.
+    RingBuffer<float, 2, 0, SampleFormats::Int16>. Samples are converted on
+    write and converted back on read, so readers still receive floats, while
+    ReadView gives access to the packed data for direct upload to the GPU.
+    
+    Every write is also stamped with the host time it was made at. Together
+    with the sample rate and output latency given to setTiming(), this lets a
+    renderer work out which sample is leaving the speakers at any moment, see
+    getSampleIndexAtTime(), and read the window ending there with readAt().
 */
-template <class Type>
+template <class Type, int NumChannels = 0, int Capacity = 0, class Format = SampleFormats::Native<Type>>
 class RingBuffer
 {
 public:
     
+    /** The type each sample is stored as inside the ring. */
+    using StorageType = typename Format::StorageType;
+    
+    /** Use as NumChannels or Capacity to choose that value at runtime. */
+    enum { dynamicSize = 0 };
+    
+    static_assert (NumChannels >= 0, "NumChannels must be positive or dynamicSize");
+    static_assert (Capacity >= 0 && (Capacity & (Capacity - 1)) == 0,
+                   "Capacity must be a power of two or dynamicSize");
+    
     /** Initializes the RingBuffer with the specified channels and size.
      
         @param numChannels  number of channels of audio to store in buffer
-        @param bufferSize   size of the audio buffer
+        @param bufferSize   minimum size of the audio buffer. This is rounded
+                            up to the next power of two, see getBufferSize()
      */
     RingBuffer (int numChannels, int bufferSize)
     {
-        this->bufferSize = bufferSize;
-        this->numChannels = numChannels;
+        jassert (numChannels > 0 && bufferSize > 0);
+        
+        // The smallest size that still fills a whole storage alignment block,
+        // so every channel's start stays aligned
+        const int minimumBufferSize = storageAlignment / (int) sizeof (StorageType);
+        
+        runtimeBufferSize = nextPowerOfTwo (jmax (bufferSize, minimumBufferSize));
+        runtimeNumChannels = numChannels;
+        
+        // A compile-time size must match what it is constructed with
+        jassert (Capacity == dynamicSize || Capacity == runtimeBufferSize);
+        jassert (NumChannels == dynamicSize || NumChannels == runtimeNumChannels);
         
-        audioBuffer = std::make_unique<AudioBuffer<Type>> (numChannels, bufferSize);
-        writePosition = 0;
+        allocateChannels();
+    }
+    
+    /** Initializes a RingBuffer whose channels and size are both fixed at
+        compile time.
+     */
+    RingBuffer()  : RingBuffer (NumChannels, Capacity)
+    {
+        static_assert (NumChannels != dynamicSize && Capacity != dynamicSize,
+                       "Use the (numChannels, bufferSize) constructor for runtime sizes");
     }
     
     
     /** Writes samples to all channels in the RingBuffer.
+    
+        This is wait-free: it never loops or waits on the readers, so it is safe
+        to call from the audio thread.
      
         @param newAudioData     an audio buffer to write into the RingBuffer
                                 This AudioBuffer must have the same number of
@@ -50,120 +121,774 @@ public:
                                 into the RingBuffer
         @param numSamples       the number of samples from newAudioData to write
                                 into the RingBuffer
+        @param hostTimeTicks    the Time::getHighResolutionTicks() at which the
+                                audio callback that produced the samples started
      */
-    void writeSamples (AudioBuffer<Type> & newAudioData, int startSample, int numSamples)
+    void writeSamples (AudioBuffer<Type> & newAudioData, int startSample, int numSamples,
+                       int64 hostTimeTicks)
     {
-        for (int i = 0; i < numChannels; ++i)
-        {
-            const int curWritePosition = writePosition.get();
+        jassert (numSamples <= getBufferSize());
+        jassert (newAudioData.getNumChannels() >= getNumChannels());
+        
+        // Only the writer modifies writeCount, so a relaxed load is enough here
+        const int64 startIndex = writeCount.load (std::memory_order_relaxed);
+        const int64 endIndex = startIndex + numSamples;
+        
+        // Announce the samples we are about to overwrite before touching them
+        writeClaim.store (endIndex, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+        
+        const int writePosition = (int) (startIndex & getBufferMask());
+        
+        for (int i = 0; i < getNumChannels(); ++i)
+            copyIntoRing (channels[i], writePosition,
+                          newAudioData.getReadPointer (i, startSample), numSamples);
             
-            // If we need to loop around the ring
-            if (curWritePosition + numSamples > bufferSize - 1)
-            {
-                int samplesToEdgeOfBuffer = bufferSize - curWritePosition;
+        // Publish the finished samples. A single store, so readers never see
+        // an intermediate or out-of-range position.
+        writeCount.store (endIndex, std::memory_order_release);
+        
+        stampClock (startIndex, hostTimeTicks);
+    }
+    
+    /** Writes samples to all channels, stamped with the current host time. */
+    void writeSamples (AudioBuffer<Type> & newAudioData, int startSample, int numSamples)
+    {
+        writeSamples (newAudioData, startSample, numSamples, Time::getHighResolutionTicks());
+    }
                 
-                audioBuffer->copyFrom (i, curWritePosition, newAudioData, i,
-                                       startSample, samplesToEdgeOfBuffer);
+    //==========================================================================
+    // Zero-Copy Views
                 
-                audioBuffer->copyFrom (i, 0, newAudioData, i,
-                                       startSample + samplesToEdgeOfBuffer,
-                                       numSamples - samplesToEdgeOfBuffer);
-            }
-            // If we stay inside the ring
-            else
-            {
-                audioBuffer->copyFrom (i, curWritePosition, newAudioData, i,
-                                       startSample, numSamples);
-            }
-        }
+    /** A window of samples that points straight into the ring's storage.
+        
+        Every channel of the window is made of at most two contiguous segments:
+        the first runs up to the end of the ring and the second wraps around to
+        its start. The view does not own or lock anything, so the writer may
+        overwrite it at any time. After using the data, check it with
+        isViewIntact() (or releaseView() for consumers) and discard the results
+        if the check fails.
+     */
+    struct ReadView
+    {
+        /** Returns the first contiguous segment of a channel, in the ring's
+            storage format.
+         */
+        const StorageType* getFirstSegment (int channel) const noexcept     { return channels[channel] + position; }
         
-        writePosition += numSamples;
-        writePosition = writePosition.get() % bufferSize;
+        /** Returns the wrapped around segment of a channel, in the ring's
+            storage format.
+         */
+        const StorageType* getSecondSegment (int channel) const noexcept    { return channels[channel]; }
+        
+        /** Converts a channel of the view into samples at destination. */
+        void copyChannelTo (int channel, Type* destination) const noexcept
+        {
+            Format::decode (getFirstSegment (channel), destination, firstSegmentSize);
+            Format::decode (getSecondSegment (channel), destination + firstSegmentSize, secondSegmentSize);
+        }
         
-        /*
-            Although it would seem that the above two lines could cause a
-            problem for the consumer calling readsSamples() since it uses the
-            value of writePosition to calculate the readPosition, this is not
-            the case.
+        /** Converts a channel of the view and adds it to the samples at
+            destination.
+         */
+        void addChannelTo (int channel, Type* destination) const noexcept
+        {
+            Format::add (getFirstSegment (channel), destination, firstSegmentSize);
+            Format::add (getSecondSegment (channel), destination + firstSegmentSize, secondSegmentSize);
+        }
             
-            1.  Since writePosition is Atomic, there will be no torn reads.
+        int getNumSamples() const noexcept                          { return firstSegmentSize + secondSegmentSize; }
          
-            2.  In the case that the producer only executes the line:
+        int firstSegmentSize;
+        int secondSegmentSize;
+        int64 startIndex;   // Absolute sample index of the start of the window,
+                            // this is the version that isViewIntact() checks
         
-                    writePosition += numSamples;
+    private:
+        friend class RingBuffer;
+        const StorageType* const* channels;
+        int position;
+    };
          
-                then writePosition has the posibility of being outside the
-                bounds of the buffer. If the consumer then calls readsSamples()
-                and executes the line:
+    /** Returns a view of the most recent readSize samples, without copying.
+        See ReadView for how to use it safely.
+     */
+    ReadView getLatestView (int readSize) const
+    {
+        jassert (readSize < getBufferSize());
          
-                    int readPosition = (writePosition.get() % bufferSize) - readSize;
+        // Acquire pairs with the writer's release, so every sample up to the
+        // write count is visible to us
+        return makeView (writeCount.load (std::memory_order_acquire) - readSize, readSize);
+    }
          
-                it protects itself from an out-of-bounds writePosition by
-                calculating the modulus with the buffer size. If the
-                writePosition is outside the bounds of the buffer momentarily,
-                the consumer's call to readSamples() stays protected and accurate.
-         */
+    /** Returns true if nothing in the view has been overwritten yet. Call this
+        after reading from the view's segments.
+        
+        Also counts overwritten views in the telemetry, see getTelemetry().
+     */
+    bool isViewIntact (const ReadView& view)
+    {
+        // Make sure all reads from the view are finished before checking what
+        // the writer has claimed in the meantime
+        std::atomic_thread_fence (std::memory_order_acquire);
+        
+        if (isOverwritten (view.startIndex))
+        {
+            readerTelemetry.overlapEvents.fetch_add (1, std::memory_order_relaxed);
+            return false;
+        }
+        
+        return true;
     }
     
     /** Reads readSize number of samples in front of the write position from all
         channels in the RingBuffer into the bufferToFill.
+        
+        If the writer overwrites the window while it is being copied, the read
+        is retried a few times before giving up.
      
          @param bufferToFill    buffer to be filled with most recent audio
                                 samples from the RingBuffer
          @param readSize        number of samples to read from the RingBuffer.
                                 Note, this must be less than the buffer size
                                 of the RingBuffer specified in the constructor.
+         @returns               true if bufferToFill holds a consistent window,
+                                false if every attempt was overwritten mid-read
     */
-    void readSamples (AudioBuffer<Type> & bufferToFill, int readSize)
+    bool readSamples (AudioBuffer<Type> & bufferToFill, int readSize)
     {
         // Ensure readSize does not exceed bufferSize
-        jassert (readSize < bufferSize);
-        
-        /*
-            Further, as stated in the class comment, it is also bad to have a
-            read zone that overlaps with the writing zone, but this wont't cause
-            too much of a visual problem unless it happens often.
-            To combat this, the user should avoid having any read size and any
-            write size that when added together, exceed the bufferSize of the
-            RingBuffer.
-         */
+        jassert (readSize < getBufferSize());
+        
+        for (int attempt = 0; attempt < maxReadAttempts; ++attempt)
+        {
+            const ReadView view = getLatestView (readSize);
+        
+            copyView (bufferToFill, view);
+        
+            if (isViewIntact (view))
+                return true;
+        }
+        
+        return false;
+    }
+    
+    /** Sums all channels of the most recent readSize samples into a single
+        channel, reading straight from the ring without an intermediate copy.
+        Retried like readSamples() if the window is overwritten mid-read.
+        
+        @param destination  receives readSize summed samples
+        @param readSize     number of samples to read from the RingBuffer
+        @returns            true if destination holds a consistent window
+     */
+    bool readSummedSamples (Type* destination, int readSize)
+    {
+        for (int attempt = 0; attempt < maxReadAttempts; ++attempt)
+        {
+            const ReadView view = getLatestView (readSize);
+            
+            sumView (destination, view);
+            
+            if (isViewIntact (view))
+                return true;
+        }
         
-        // Calculate readPosition based on writePosition
-        int readPosition = (writePosition.get() % bufferSize) - readSize;
+        return false;
+    }
+    
+    //==========================================================================
+    // Sample Clock
+    
+    /** The absolute index of a sample paired with the host time at which the
+        audio callback that wrote it started.
+     */
+    struct ClockStamp
+    {
+        int64 sampleIndex;
+        int64 hostTimeTicks;
+    };
+    
+    /** Sets the timing used to convert host time into sample indices. Call it
+        whenever the audio device is (re)started.
         
-        // If read position goes into negative bounds, loop it around the ring
-        if (readPosition < 0)
-            readPosition = bufferSize + readPosition;
+        @param newSampleRate            the device's sample rate
+        @param newOutputLatencySamples  the samples between a block being
+                                        written and it reaching the speakers
+        @param newBlockSize             the samples the device writes at once
+     */
+    void setTiming (double newSampleRate, int newOutputLatencySamples, int newBlockSize) noexcept
+    {
+        sampleRate.store (newSampleRate, std::memory_order_relaxed);
+        outputLatencySamples.store (newOutputLatencySamples, std::memory_order_relaxed);
+        blockSize.store (newBlockSize, std::memory_order_relaxed);
+    }
+    
+    /** Returns the sample rate passed to setTiming(), or 0 before it's called. */
+    double getSampleRate() const noexcept
+    {
+        return sampleRate.load (std::memory_order_relaxed);
+    }
+    
+    /** Returns the longest window that can be read at the index returned by
+        getSampleIndexAtTime() without it being overwritten while it's read.
+        That window ends the output latency behind the newest sample, and the
+        writer may write another block meanwhile.
+     */
+    int getMaxTimedReadSize() const noexcept
+    {
+        const int reserved = outputLatencySamples.load (std::memory_order_relaxed)
+                               + blockSize.load (std::memory_order_relaxed);
         
-        for (int i = 0; i < numChannels; ++i)
+        return jmax (1, getBufferSize() - jmax (1, reserved));
+    }
+    
+    /** Returns the stamp of the most recent write. */
+    ClockStamp getLatestStamp() const noexcept
+    {
+        for (;;)
         {
-            // If we need to loop around the ring
-            if (readPosition + readSize > bufferSize - 1)
+            // The writer makes the sequence odd while it updates the stamp
+            const int64 sequence = clock.sequence.load (std::memory_order_acquire);
+            
+            if ((sequence & 1) == 0)
             {
-                int samplesToEdgeOfBuffer = bufferSize - readPosition;
+                ClockStamp stamp;
+                stamp.sampleIndex = clock.sampleIndex.load (std::memory_order_relaxed);
+                stamp.hostTimeTicks = clock.hostTimeTicks.load (std::memory_order_relaxed);
                 
-                bufferToFill.copyFrom (i, 0, *audioBuffer, i, readPosition,
-                                       samplesToEdgeOfBuffer);
+                std::atomic_thread_fence (std::memory_order_acquire);
                 
-                bufferToFill.copyFrom (i, samplesToEdgeOfBuffer, *audioBuffer,
-                                       i, 0,
-                                       readSize - samplesToEdgeOfBuffer);
+                if (clock.sequence.load (std::memory_order_relaxed) == sequence)
+                    return stamp;
             }
-            // If we stay inside the ring
-            else
+        }
+    }
+    
+    /** Returns the absolute index of the sample that leaves the speakers at the
+        given host time, extrapolated from the latest stamp. Can be passed to
+        readAt() to get the window that is audible at that time.
+        
+        Before setTiming() has been called, or before anything has been written,
+        this is simply the most recently written sample.
+        
+        Predictions past the most recently written sample are clamped to it and
+        counted in the telemetry, see getTelemetry().
+     */
+    int64 getSampleIndexAtTime (int64 hostTimeTicks) noexcept
+    {
+        const int64 latestIndex = writeCount.load (std::memory_order_acquire);
+        const double rate = sampleRate.load (std::memory_order_relaxed);
+        
+        if (rate <= 0.0 || latestIndex == 0)
+            return latestIndex;
+        
+        const ClockStamp stamp = getLatestStamp();
+        const double elapsedSamples = rate * Time::highResolutionTicksToSeconds (hostTimeTicks - stamp.hostTimeTicks);
+        
+        const int64 index = stamp.sampleIndex + (int64) elapsedSamples
+                              - outputLatencySamples.load (std::memory_order_relaxed);
+        
+        // Never ask for samples that haven't been written yet. If this happens
+        // often the latency passed to setTiming() is too low.
+        if (index > latestIndex)
+        {
+            readerTelemetry.clampedLookups.fetch_add (1, std::memory_order_relaxed);
+            return latestIndex;
+        }
+        
+        return index;
+    }
+    
+    /** Returns a view of the readSize samples that end at the absolute sample
+        index, without copying. The end is clamped to the most recently written
+        sample. See ReadView for how to use it safely.
+     */
+    ReadView getViewAt (int64 endIndex, int readSize) const
+    {
+        jassert (readSize < getBufferSize());
+        
+        const int64 latestIndex = writeCount.load (std::memory_order_acquire);
+        return makeView (jmin (endIndex, latestIndex) - readSize, readSize);
+    }
+    
+    /** Reads the readSize samples that end at the absolute sample index from all
+        channels into bufferToFill, e.g. the window returned for the predicted
+        presentation time of a frame by getSampleIndexAtTime().
+        
+        Unlike readSamples() this is not retried, as the same window would just
+        be overwritten again.
+        
+        @returns    true if bufferToFill holds a consistent window, false if the
+                    window was overwritten before or while it was read
+     */
+    bool readAt (AudioBuffer<Type> & bufferToFill, int64 endIndex, int readSize)
+    {
+        const ReadView view = getViewAt (endIndex, readSize);
+        
+        copyView (bufferToFill, view);
+        
+        return isViewIntact (view);
+    }
+    
+    /** Sums all channels of the readSize samples that end at the absolute sample
+        index into destination. See readAt().
+     */
+    bool readSummedAt (Type* destination, int64 endIndex, int readSize)
+    {
+        const ReadView view = getViewAt (endIndex, readSize);
+        
+        sumView (destination, view);
+        
+        return isViewIntact (view);
+    }
+    
+    //==========================================================================
+    // Consumers
+    
+    /** Registers a consumer with its own read cursor, for use with
+        readNewSamples() and getNewSamplesView(). The cursor starts at the
+        current write position, so the consumer only sees samples written after
+        it was added.
+        
+        @returns    an id to pass to readNewSamples() and removeConsumer(), or
+                    -1 if all maxConsumers slots are in use
+     */
+    int addConsumer()
+    {
+        for (int i = 0; i < maxConsumers; ++i)
+        {
+            bool expected = false;
+            
+            if (consumers[i].inUse.compare_exchange_strong (expected, true, std::memory_order_acq_rel))
             {
-                bufferToFill.copyFrom (i, 0, *audioBuffer, i, readPosition, readSize);
+                consumers[i].readCount.store (writeCount.load (std::memory_order_acquire),
+                                              std::memory_order_relaxed);
+                consumers[i].maxLag.store (0, std::memory_order_relaxed);
+                return i;
             }
         }
+        
+        jassertfalse; // Too many consumers, raise maxConsumers
+        return -1;
     }
     
+    /** Releases a consumer slot that was returned by addConsumer(). */
+    void removeConsumer (int consumerId)
+    {
+        jassert (isPositiveAndBelow (consumerId, (int) maxConsumers));
+        consumers[consumerId].inUse.store (false, std::memory_order_release);
+    }
+    
+    /** Returns a view of the samples written since this consumer's last read,
+        without copying. Pass the view to releaseView() once done with it to
+        check it and advance the consumer's cursor.
+        
+        @param consumerId       an id returned by addConsumer()
+        @param maxSamples       the largest number of samples in the view. Any
+                                further new samples are left for the next call.
+        @param droppedSamples   set to the number of samples that were skipped
+                                because they were overwritten before being read
+     */
+    ReadView getNewSamplesView (int consumerId, int maxSamples, int64 & droppedSamples) const
+    {
+        jassert (isPositiveAndBelow (consumerId, (int) maxConsumers));
+        
+        const int64 lastReadCount = consumers[consumerId].readCount.load (std::memory_order_relaxed);
+        const int64 endIndex = writeCount.load (std::memory_order_acquire);
+        
+        // If we fell behind, skip to the oldest sample that the writer is not
+        // about to overwrite
+        const int64 oldestIntactIndex = writeClaim.load (std::memory_order_relaxed) - getBufferSize();
+        const int64 startIndex = jmax (lastReadCount, oldestIntactIndex);
+        
+        droppedSamples = startIndex - lastReadCount;
+        
+        // The claim is loaded after the count, so the writer may have claimed
+        // a whole ring past it in between, which leaves nothing to read
+        return makeView (startIndex, (int) jlimit ((int64) 0, (int64) maxSamples, endIndex - startIndex));
+    }
+    
+    /** Checks a view returned by getNewSamplesView() and, if it is intact,
+        advances the consumer's cursor past it.
+        
+        @returns    true if the view was intact. If false, whatever was read from
+                    the view must be discarded, and the samples will be counted
+                    as dropped by the next getNewSamplesView() call.
+     */
+    bool releaseView (int consumerId, const ReadView& view)
+    {
+        jassert (isPositiveAndBelow (consumerId, (int) maxConsumers));
+        
+        if (! isViewIntact (view))
+            return false;
+        
+        const int64 endIndex = view.startIndex + view.getNumSamples();
+        consumers[consumerId].readCount.store (endIndex, std::memory_order_relaxed);
+        recordReadLag (consumerId, writeCount.load (std::memory_order_relaxed) - endIndex);
+        return true;
+    }
+    
+    /** Reads the samples written since this consumer's last read into the
+        start of bufferToFill, and advances the consumer's cursor past them.
+        
+        Every sample is delivered exactly once unless the consumer falls more
+        than a whole ring behind the writer. In that case the oldest samples
+        are skipped and counted in droppedSamples.
+        
+        Only the thread that owns a consumer id may read with it.
+        
+        @param consumerId       an id returned by addConsumer()
+        @param bufferToFill     buffer to be filled with the new samples. Must
+                                hold at least maxSamples samples per channel.
+        @param maxSamples       the largest number of samples to read. Any
+                                further new samples are left for the next call.
+        @param droppedSamples   set to the number of samples that were skipped
+                                because they were overwritten before being read
+        @returns                the number of samples written into bufferToFill
+     */
+    int readNewSamples (int consumerId, AudioBuffer<Type> & bufferToFill, int maxSamples, int64 & droppedSamples)
+    {
+        jassert (maxSamples <= bufferToFill.getNumSamples());
+        
+        droppedSamples = 0;
+        
+        for (int attempt = 0; attempt < maxReadAttempts; ++attempt)
+        {
+            // The cursor only moves on success, so every attempt measures the
+            // skipped samples from the same place and only the last one counts
+            int64 skippedSamples = 0;
+            const ReadView view = getNewSamplesView (consumerId, maxSamples, skippedSamples);
+            
+            copyView (bufferToFill, view);
+            
+            if (releaseView (consumerId, view))
+            {
+                droppedSamples = skippedSamples;
+                return view.getNumSamples();
+            }
+        }
+        
+        return 0;
+    }
+    
+    //==========================================================================
+    // Telemetry
+    
+    /** A snapshot of the ring's counters, see getTelemetry(). */
+    struct Telemetry
+    {
+        int64 samplesWritten;   // Total samples written since construction
+        int64 overlapEvents;    // Reads that found their window overwritten
+        int64 lastReadLag;      // How many samples behind the writer the last
+                                // consumer read ended
+        int64 maxReadLag;       // The largest lastReadLag seen so far
+        int64 clampedLookups;   // getSampleIndexAtTime() calls that predicted
+                                // a sample that wasn't written yet
+    };
+    
+    /** Returns a snapshot of the ring's counters. This is cheap enough to poll
+        every frame from the GUI. The counters are read independently, so they
+        may be a few samples apart from each other.
+        
+        The read lag only covers consumers, which are meant to keep up with the
+        writer. Reads of the latest window are never behind, and readAt() is
+        behind by the output latency on purpose, so neither is measured.
+     */
+    Telemetry getTelemetry() const noexcept
+    {
+        Telemetry telemetry;
+        telemetry.samplesWritten = writeCount.load (std::memory_order_relaxed);
+        telemetry.overlapEvents = readerTelemetry.overlapEvents.load (std::memory_order_relaxed);
+        telemetry.lastReadLag = readerTelemetry.lastReadLag.load (std::memory_order_relaxed);
+        telemetry.maxReadLag = readerTelemetry.maxReadLag.load (std::memory_order_relaxed);
+        telemetry.clampedLookups = readerTelemetry.clampedLookups.load (std::memory_order_relaxed);
+        return telemetry;
+    }
+    
+    /** Returns how many samples a consumer is behind the writer. */
+    int64 getConsumerLag (int consumerId) const noexcept
+    {
+        jassert (isPositiveAndBelow (consumerId, (int) maxConsumers));
+        return writeCount.load (std::memory_order_relaxed)
+                 - consumers[consumerId].readCount.load (std::memory_order_relaxed);
+    }
+    
+    /** Returns the furthest a consumer has been behind the writer at the end of
+        a read, since it was added or resetMaxReadLag() was called.
+     */
+    int64 getConsumerMaxLag (int consumerId) const noexcept
+    {
+        jassert (isPositiveAndBelow (consumerId, (int) maxConsumers));
+        return consumers[consumerId].maxLag.load (std::memory_order_relaxed);
+    }
+    
+    /** Starts measuring maxReadLag, and every consumer's maximum, again from
+        zero.
+     */
+    void resetMaxReadLag() noexcept
+    {
+        readerTelemetry.maxReadLag.store (0, std::memory_order_relaxed);
+        
+        for (auto& consumer : consumers)
+            consumer.maxLag.store (0, std::memory_order_relaxed);
+    }
+    
+    /** Returns the actual size of the ring, which is the size given to the
+        constructor rounded up to a power of two.
+     */
+    int getBufferSize() const noexcept      { return Capacity != dynamicSize ? Capacity : runtimeBufferSize; }
+    
+    /** Returns the mask that wraps an absolute sample index into the ring. */
+    int getBufferMask() const noexcept      { return getBufferSize() - 1; }
+    
+    /** Returns the number of channels stored in the ring. */
+    int getNumChannels() const noexcept     { return NumChannels != dynamicSize ? NumChannels : runtimeNumChannels; }
+
 private:
-    int bufferSize;
-    int numChannels;
-    std::unique_ptr<AudioBuffer<Type>> audioBuffer;
-    Atomic<int> writePosition; // This must be atomic so the conumer does
-                               // not read it in a torn state as it is being
-                               // changed.
+    
+    /** Allocates one block for all channels, with every channel aligned to
+        storageAlignment bytes, and clears it so that reads made before the ring
+        has filled up are silent.
+     */
+    void allocateChannels()
+    {
+        // bufferSize is a power of two at least as large as one alignment
+        // block, so consecutive channels stay aligned
+        const size_t channelBytes = sizeof (StorageType) * (size_t) getBufferSize();
+        
+        storage.calloc (channelBytes * (size_t) getNumChannels() + storageAlignment);
+        channels.malloc ((size_t) getNumChannels());
+        
+        const pointer_sized_int alignedStart = ((pointer_sized_int) storage.get() + storageAlignment - 1)
+                                                 & ~((pointer_sized_int) storageAlignment - 1);
+        
+        for (int i = 0; i < getNumChannels(); ++i)
+            channels[i] = reinterpret_cast<StorageType*> (alignedStart + (pointer_sized_int) (channelBytes * (size_t) i));
+    }
+    
+    /** Copies numSamples from source into one ring channel, starting at the
+        given position in the ring and wrapping around its end if needed.
+        
+        Each of the (at most) two contiguous segments is converted in one go.
+        For the native format that is a single memcpy, which the platform
+        library implements with the widest vector moves available.
+     */
+    void copyIntoRing (StorageType* ringChannel, int position, const Type* source, int numSamples) const noexcept
+    {
+        const int samplesToEdgeOfBuffer = jmin (numSamples, getBufferSize() - position);
+        
+        Format::encode (source, ringChannel + position, samplesToEdgeOfBuffer);
+        
+        // If we need to loop around the ring
+        if (samplesToEdgeOfBuffer < numSamples)
+            Format::encode (source + samplesToEdgeOfBuffer, ringChannel,
+                            numSamples - samplesToEdgeOfBuffer);
+    }
+    
+    /** Creates a view of numSamples starting at the absolute sample index.
+        Does not check for overlap with the writer.
+     */
+    ReadView makeView (int64 startIndex, int numSamples) const noexcept
+    {
+        ReadView view;
+        view.channels = channels.get();
+        view.startIndex = startIndex;
+        
+        // Before the ring has filled up, the start index can be negative. The
+        // mask still wraps it to the right position, and that part of the ring
+        // was cleared on construction, so the window is silent there.
+        view.position = (int) (startIndex & getBufferMask());
+        view.firstSegmentSize = jmin (numSamples, getBufferSize() - view.position);
+        view.secondSegmentSize = numSamples - view.firstSegmentSize;
+        return view;
+    }
+    
+    /** Copies every channel of the view into the start of bufferToFill. */
+    void copyView (AudioBuffer<Type> & bufferToFill, const ReadView& view) const
+    {
+        for (int i = 0; i < getNumChannels(); ++i)
+            view.copyChannelTo (i, bufferToFill.getWritePointer (i));
+    }
+    
+    /** Sums every channel of the view into destination. */
+    void sumView (Type* destination, const ReadView& view) const
+    {
+        view.copyChannelTo (0, destination);
+        
+        for (int i = 1; i < getNumChannels(); ++i)
+            view.addChannelTo (i, destination);
+    }
+    
+    /** Publishes the host time of a write, using the clock's sequence number
+        to let readers detect a torn stamp.
+     */
+    void stampClock (int64 sampleIndex, int64 hostTimeTicks) noexcept
+    {
+        // Only the writer modifies the sequence
+        const int64 sequence = clock.sequence.load (std::memory_order_relaxed);
+        
+        clock.sequence.store (sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+        
+        clock.sampleIndex.store (sampleIndex, std::memory_order_relaxed);
+        clock.hostTimeTicks.store (hostTimeTicks, std::memory_order_relaxed);
+        
+        clock.sequence.store (sequence + 2, std::memory_order_release);
+    }
+    
+    /** Stores the lag of a consumer's intact read and raises the maxima if
+        needed.
+     */
+    void recordReadLag (int consumerId, int64 lag) noexcept
+    {
+        readerTelemetry.lastReadLag.store (lag, std::memory_order_relaxed);
+        
+        // Only the consumer's own thread raises its maximum
+        std::atomic<int64>& consumerMaxLag = consumers[consumerId].maxLag;
+        
+        if (lag > consumerMaxLag.load (std::memory_order_relaxed))
+            consumerMaxLag.store (lag, std::memory_order_relaxed);
+        
+        int64 previousMaxLag = readerTelemetry.maxReadLag.load (std::memory_order_relaxed);
+        
+        while (lag > previousMaxLag
+                && ! readerTelemetry.maxReadLag.compare_exchange_weak (previousMaxLag, lag, std::memory_order_relaxed))
+        {}
+    }
+    
+    /** Returns true if the writer has claimed samples far enough ahead that the
+        window starting at the absolute sample index may have been overwritten.
+     */
+    bool isOverwritten (int64 startIndex) const
+    {
+        // The oldest sample still intact is bufferSize behind the writer's claim
+        const int64 oldestIntactIndex = writeClaim.load (std::memory_order_relaxed) - getBufferSize();
+        return startIndex < oldestIntactIndex;
+    }
+    
+    
+    enum
+    {
+        cacheLineSize = 64,     // Padding that keeps the counters below from
+                                // false sharing with each other
+        storageAlignment = 64,  // Alignment of every channel, wide enough for
+                                // AVX-512 loads
+        maxReadAttempts = 3,
+        maxConsumers = 8
+    };
+    
+    // Read-only after construction, shared by the producer and all consumers
+    int runtimeBufferSize;      // Only used when Capacity is dynamicSize
+    int runtimeNumChannels;     // Only used when NumChannels is dynamicSize
+    HeapBlock<char> storage;    // Holds all channels, with room for alignment
+    HeapBlock<StorageType*> channels;  // Aligned start of each channel in storage
+    
+    // Set by setTiming(), read by the renderers
+    std::atomic<double> sampleRate { 0.0 };
+    std::atomic<int> outputLatencySamples { 0 };
+    std::atomic<int> blockSize { 0 };
+    
+    // The groups of counters below are written by different threads. Each one
+    // starts with a cache line of padding, so no two groups share a line.
+    // This is done with padding rather than alignas, which would make the
+    // ring an over-aligned type that needs the aligned operator new, which
+    // older macOS deployment targets don't have, and warns on MSVC (C4324).
+    
+    // Producer state, only ever modified by the writer, so that consumers
+    // reading the members above don't have their cache lines invalidated
+    // every time the audio thread writes
+    char producerPadding [cacheLineSize];
+    std::atomic<int64> writeCount { 0 };
+    std::atomic<int64> writeClaim { 0 };
+    
+    // Consumer state. Every cursor has its own cache line, so consumers on
+    // different threads don't false share with each other or with the writer.
+    struct ConsumerSlot
+    {
+        char padding [cacheLineSize];
+        std::atomic<bool> inUse { false };
+        std::atomic<int64> readCount { 0 };  // Only modified by the consumer
+        std::atomic<int64> maxLag { 0 };     // See getConsumerMaxLag()
+    };
+    
+    ConsumerSlot consumers [maxConsumers];
+    
+    // Counters updated by the readers. The writer's sample count doubles as
+    // its telemetry, so recording costs the audio thread nothing extra.
+    struct ReaderTelemetry
+    {
+        char padding [cacheLineSize];
+        std::atomic<int64> overlapEvents { 0 };
+        std::atomic<int64> lastReadLag { 0 };
+        std::atomic<int64> maxReadLag { 0 };
+        std::atomic<int64> clampedLookups { 0 };
+    };
+    
+    ReaderTelemetry readerTelemetry;
+    
+    // The stamp of the latest write, guarded by a sequence number. Written by
+    // the producer once per block and read by renderers once per frame.
+    struct Clock
+    {
+        char padding [cacheLineSize];
+        std::atomic<int64> sequence { 0 };
+        std::atomic<int64> sampleIndex { 0 };
+        std::atomic<int64> hostTimeTicks { 0 };
+        char endPadding [cacheLineSize];     // Keeps whatever follows the ring off this line
+    };
+    
+    Clock clock;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RingBuffer)
 };
+
+
+//==============================================================================
+/** Predicts when the frame being rendered reaches the screen, to pass to
+    RingBuffer::getSampleIndexAtTime().
+    
+    A frame is taken to be presented one frame interval after it starts. The
+    interval is measured between calls to startFrame(), and capped so that a
+    stall doesn't push the prediction far into the future.
+ */
+class FramePresentationClock
+{
+public:
+    /** Forgets the previous frame, e.g. when rendering starts again after
+        being stopped, as the time in between isn't a frame interval.
+     */
+    void reset() noexcept
+    {
+        lastFrameTicks = 0;
+    }
+    
+    /** Called at the start of every frame, from the render thread. */
+    void startFrame() noexcept
+    {
+        const int64 nowTicks = Time::getHighResolutionTicks();
+        const int64 previousFrameTicks = lastFrameTicks.exchange (nowTicks);
+        
+        frameTicks = previousFrameTicks > 0 ? jmin (nowTicks - previousFrameTicks, maxFrameTicks) : 0;
+        presentTicks = nowTicks + frameTicks;
+    }
+    
+    /** How long the previous frame took, capped, or 0 after reset(). */
+    int64 getFrameTicks() const noexcept        { return frameTicks; }
+    
+    /** The host time the current frame is predicted to be shown at. */
+    int64 getPresentTicks() const noexcept      { return presentTicks; }
+
+private:
+    std::atomic<int64> lastFrameTicks { 0 };    // When the previous frame started, 0 after reset()
+    int64 frameTicks = 0;
+    int64 presentTicks = 0;
+    const int64 maxFrameTicks = Time::secondsToHighResolutionTicks (0.1);
+};
+
+
+/** The ring buffer the audio callback writes into and all the visualizers read
+    from. The app always visualizes stereo, so the channel count is fixed, but
+    the size depends on the audio device's block size.
+ */
+using VisualizerRingBuffer = RingBuffer<GLfloat, 2>;
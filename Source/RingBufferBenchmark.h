@@ -0,0 +1,380 @@
+//
+//  RingBufferBenchmark.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBuffer.h"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/** Headless microbenchmarks for the RingBuffer. These need no GUI or audio
+    device. Run the app with --benchmark-ringbuffer to run them and print the
+    results instead of opening the main window.
+    
+    Add --benchmark-output=<file> to also save the threaded results, as JSON if
+    the file name ends in .json and as CSV otherwise, so they can be compared
+    between releases.
+ */
+class RingBufferBenchmark
+{
+public:
+    
+    /** Runs every benchmark and prints the results to stdout.
+    
+        @param outputPath   if not empty, the file the threaded results are
+                            written to, relative to the working directory
+     */
+    static void run (const String& outputPath = {})
+    {
+        compareCompileTimeSizes();
+        
+        const std::vector<Result> results = runThreadedSuite();
+        
+        if (outputPath.isNotEmpty())
+        {
+            const bool asJson = outputPath.endsWithIgnoreCase (".json");
+            const File outputFile = File::getCurrentWorkingDirectory().getChildFile (outputPath);
+            
+            if (outputFile.replaceWithText (asJson ? toJson (results) : toCsv (results)))
+                std::cout << "Results written to " << outputFile.getFullPathName() << std::endl;
+            else
+                std::cout << "Could not write " << outputFile.getFullPathName() << std::endl;
+        }
+    }
+
+private:
+    
+    /** One combination of sizes for the threaded benchmark. */
+    struct Config
+    {
+        int numChannels;
+        int capacity;
+        int blockSize;
+        int numReaders;
+    };
+    
+    /** Per-call latencies in nanoseconds. */
+    struct LatencyStats
+    {
+        double p50 = 0.0, p99 = 0.0, p999 = 0.0;
+    };
+    
+    struct Result
+    {
+        Config config;
+        double writeSamplesPerSecond;   // Per channel
+        LatencyStats writeLatency;
+        LatencyStats readLatency;
+        int64 numReads;                 // readSamples() calls
+        int64 numFailedReads;           // Calls where every attempt overlapped
+        int64 overlapEvents;            // Overwritten attempts, see RingBuffer::Telemetry
+        
+        /** The fraction of read attempts that were overwritten mid-read. */
+        double getOverlapRate() const
+        {
+            // Every successful call made exactly one intact attempt
+            const int64 attempts = numReads - numFailedReads + overlapEvents;
+            return attempts > 0 ? (double) overlapEvents / (double) attempts : 0.0;
+        }
+    };
+    
+    enum
+    {
+        readSize = 256,                 // The window the visualizers read
+        samplesPerRun = 1 << 22,        // Written per channel in every run
+        maxRecordedReads = 1 << 20      // Per reader, later reads aren't timed
+    };
+    
+    //==========================================================================
+    /** Runs the producer on one thread and the readers on others for every
+        combination of block size, channel count, capacity and reader count,
+        printing a line per combination.
+     */
+    static std::vector<Result> runThreadedSuite()
+    {
+        std::vector<Result> results;
+        
+        std::cout << "RingBuffer: threaded write/read (" << readSize << " sample reads)" << std::endl
+                  << "    channels capacity block readers | Msamples/s | write p50/p99/p999 ns"
+                  << " | read p50/p99/p999 ns | overlap rate" << std::endl;
+        
+        for (int numReaders : { 1, 3 })
+            for (int capacity : { 8192, 65536 })
+                for (int numChannels : { 1, 2, 8 })
+                    for (int blockSize : { 16, 64, 256, 1024, 4096 })
+                    {
+                        const Result result = runThreaded ({ numChannels, capacity, blockSize, numReaders });
+                        results.push_back (result);
+                        
+                        std::cout << "    " << numChannels << " " << capacity << " " << blockSize << " " << numReaders
+                                  << " | " << result.writeSamplesPerSecond / 1.0e6
+                                  << " | " << result.writeLatency.p50 << " / " << result.writeLatency.p99
+                                  << " / " << result.writeLatency.p999
+                                  << " | " << result.readLatency.p50 << " / " << result.readLatency.p99
+                                  << " / " << result.readLatency.p999
+                                  << " | " << result.getOverlapRate() << std::endl;
+                    }
+        
+        return results;
+    }
+    
+    /** Writes samplesPerRun samples per channel from a producer thread as fast
+        as it can, while every reader thread keeps reading the latest window,
+        and times every call on both sides.
+     */
+    static Result runThreaded (const Config& config)
+    {
+        RingBuffer<float> ring (config.numChannels, config.capacity);
+        
+        AudioBuffer<float> block (config.numChannels, config.blockSize);
+        fillWithNoise (block);
+        
+        const int numBlocks = jmax (1, (int) samplesPerRun / config.blockSize);
+        std::vector<int64> writeTicks ((size_t) numBlocks);
+        
+        std::vector<std::vector<int64>> readTicks ((size_t) config.numReaders);
+        
+        // Every reader counts in locals and only stores its counts here once
+        // it's done, so the readers don't share a cache line while timed
+        std::vector<int64> failedReads ((size_t) config.numReaders, 0);
+        std::vector<int64> totalReads ((size_t) config.numReaders, 0);
+        
+        std::atomic<int> readersReady { 0 };
+        std::atomic<bool> producerDone { false };
+        std::vector<std::thread> readers;
+        
+        for (int r = 0; r < config.numReaders; ++r)
+        {
+            readers.emplace_back ([&, r]
+            {
+                AudioBuffer<float> window (config.numChannels, readSize);
+                std::vector<int64>& ticks = readTicks[(size_t) r];
+                ticks.reserve (maxRecordedReads);
+                int64 numReads = 0, numFailed = 0;
+                
+                readersReady.fetch_add (1);
+                
+                while (! producerDone.load (std::memory_order_acquire))
+                {
+                    const int64 startTicks = Time::getHighResolutionTicks();
+                    const bool intact = ring.readSamples (window, readSize);
+                    const int64 elapsedTicks = Time::getHighResolutionTicks() - startTicks;
+                    
+                    if (ticks.size() < (size_t) maxRecordedReads)
+                        ticks.push_back (elapsedTicks);
+                    
+                    ++numReads;
+                    
+                    if (! intact)
+                        ++numFailed;
+                }
+                
+                totalReads[(size_t) r] = numReads;
+                failedReads[(size_t) r] = numFailed;
+            });
+        }
+        
+        // Start writing once every reader is running
+        while (readersReady.load() < config.numReaders)
+            std::this_thread::yield();
+        
+        const int64 runStartTicks = Time::getHighResolutionTicks();
+        
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            const int64 startTicks = Time::getHighResolutionTicks();
+            ring.writeSamples (block, 0, config.blockSize, startTicks);
+            writeTicks[(size_t) i] = Time::getHighResolutionTicks() - startTicks;
+        }
+        
+        const double runSeconds = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - runStartTicks);
+        
+        producerDone.store (true, std::memory_order_release);
+        
+        for (auto& reader : readers)
+            reader.join();
+        
+        std::vector<int64> allReadTicks;
+        
+        for (auto& ticks : readTicks)
+            allReadTicks.insert (allReadTicks.end(), ticks.begin(), ticks.end());
+        
+        Result result;
+        result.config = config;
+        result.writeSamplesPerSecond = (double) numBlocks * config.blockSize / runSeconds;
+        result.writeLatency = summarise (writeTicks);
+        result.readLatency = summarise (allReadTicks);
+        result.numReads = 0;
+        result.numFailedReads = 0;
+        
+        for (int r = 0; r < config.numReaders; ++r)
+        {
+            result.numReads += totalReads[(size_t) r];
+            result.numFailedReads += failedReads[(size_t) r];
+        }
+        
+        result.overlapEvents = ring.getTelemetry().overlapEvents;
+        return result;
+    }
+    
+    /** Sorts the timings and picks out the percentiles. */
+    static LatencyStats summarise (std::vector<int64>& ticks)
+    {
+        LatencyStats stats;
+        
+        if (ticks.empty())
+            return stats;
+        
+        std::sort (ticks.begin(), ticks.end());
+        
+        auto percentile = [&ticks] (double fraction)
+        {
+            const int64 value = ticks[(size_t) (fraction * (double) (ticks.size() - 1))];
+            return 1.0e9 * Time::highResolutionTicksToSeconds (value);
+        };
+        
+        stats.p50 = percentile (0.5);
+        stats.p99 = percentile (0.99);
+        stats.p999 = percentile (0.999);
+        return stats;
+    }
+    
+    static String toCsv (const std::vector<Result>& results)
+    {
+        String csv ("channels,capacity,block_size,readers,write_samples_per_sec,"
+                    "write_p50_ns,write_p99_ns,write_p999_ns,read_p50_ns,read_p99_ns,read_p999_ns,"
+                    "reads,failed_reads,overlap_events,overlap_rate\n");
+        
+        for (const auto& result : results)
+        {
+            csv << result.config.numChannels << "," << result.config.capacity << ","
+                << result.config.blockSize << "," << result.config.numReaders << ","
+                << result.writeSamplesPerSecond << ","
+                << result.writeLatency.p50 << "," << result.writeLatency.p99 << "," << result.writeLatency.p999 << ","
+                << result.readLatency.p50 << "," << result.readLatency.p99 << "," << result.readLatency.p999 << ","
+                << result.numReads << "," << result.numFailedReads << "," << result.overlapEvents << ","
+                << result.getOverlapRate() << "\n";
+        }
+        
+        return csv;
+    }
+    
+    static String toJson (const std::vector<Result>& results)
+    {
+        String json ("{\n  \"benchmark\": \"RingBuffer\",\n  \"readSize\": ");
+        json << (int) readSize << ",\n  \"results\": [";
+        
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& result = results[i];
+            
+            json << (i == 0 ? "\n" : ",\n")
+                 << "    { \"channels\": " << result.config.numChannels
+                 << ", \"capacity\": " << result.config.capacity
+                 << ", \"blockSize\": " << result.config.blockSize
+                 << ", \"readers\": " << result.config.numReaders
+                 << ", \"writeSamplesPerSec\": " << result.writeSamplesPerSecond
+                 << ", \"writeNs\": { \"p50\": " << result.writeLatency.p50
+                 << ", \"p99\": " << result.writeLatency.p99
+                 << ", \"p999\": " << result.writeLatency.p999 << " }"
+                 << ", \"readNs\": { \"p50\": " << result.readLatency.p50
+                 << ", \"p99\": " << result.readLatency.p99
+                 << ", \"p999\": " << result.readLatency.p999 << " }"
+                 << ", \"reads\": " << result.numReads
+                 << ", \"failedReads\": " << result.numFailedReads
+                 << ", \"overlapEvents\": " << result.overlapEvents
+                 << ", \"overlapRate\": " << result.getOverlapRate() << " }";
+        }
+        
+        json << "\n  ]\n}\n";
+        return json;
+    }
+    
+    //==========================================================================
+    /** Compares a RingBuffer with runtime sizes against one with the same sizes
+        fixed at compile time, using the app's access pattern: small stereo
+        blocks written from the audio callback, and a 256 sample window summed
+        for every few of them.
+     */
+    static void compareCompileTimeSizes()
+    {
+        enum
+        {
+            numChannels = 2,
+            capacity = 4096,
+            numBlocks = 1 << 20
+        };
+        
+        std::cout << "RingBuffer: runtime vs compile-time sizes ("
+                  << numChannels << " channels, capacity " << capacity << ")" << std::endl;
+        
+        for (int blockSize : { 32, 256 })
+        {
+            RingBuffer<float> runtimeRing (numChannels, capacity);
+            RingBuffer<float, numChannels, capacity> compileTimeRing;
+            
+            const double runtimeNanos = timeWriteAndRead (runtimeRing, blockSize, readSize, numBlocks);
+            const double compileTimeNanos = timeWriteAndRead (compileTimeRing, blockSize, readSize, numBlocks);
+            
+            std::cout << "    block " << blockSize
+                      << ": runtime " << runtimeNanos << " ns/block"
+                      << ", compile-time " << compileTimeNanos << " ns/block"
+                      << " (" << runtimeNanos / compileTimeNanos << "x)" << std::endl;
+        }
+    }
+    
+    /** Writes numBlocks blocks into the ring, reading one summed window every
+        time a window's worth of new samples has been written.
+        
+        @returns    the average time per block in nanoseconds
+     */
+    template <class RingBufferType>
+    static double timeWriteAndRead (RingBufferType& ring, int blockSize, int windowSize, int numBlocks)
+    {
+        AudioBuffer<float> block (ring.getNumChannels(), blockSize);
+        fillWithNoise (block);
+        
+        HeapBlock<float> window ((size_t) windowSize);
+        const int blocksPerRead = jmax (1, windowSize / blockSize);
+        float checksum = 0.0f;
+        
+        const int64 startTicks = Time::getHighResolutionTicks();
+        
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            ring.writeSamples (block, 0, blockSize);
+            
+            if (i % blocksPerRead == 0)
+            {
+                ring.readSummedSamples (window, windowSize);
+                checksum += window[0];
+            }
+        }
+        
+        const int64 elapsedTicks = Time::getHighResolutionTicks() - startTicks;
+        
+        // Keeps the compiler from optimizing the reads away
+        sink = checksum;
+        
+        return 1.0e9 * Time::highResolutionTicksToSeconds (elapsedTicks) / numBlocks;
+    }
+    
+    static void fillWithNoise (AudioBuffer<float>& buffer)
+    {
+        Random random (0x5eed);
+        
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                buffer.setSample (channel, i, random.nextFloat() * 2.0f - 1.0f);
+    }
+    
+    static inline volatile float sink = 0.0f;
+};
@@ -0,0 +1,464 @@
+//
+//  RingBufferStressTest.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBuffer.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <vector>
+
+/** A headless concurrency stress test for the RingBuffer. Run the app with
+    --stress-ringbuffer to run it instead of opening the main window. The app
+    exits with 1 if any check failed.
+    
+    Every round builds a ring with a random channel count and capacity, then
+    writes a known pattern from one thread in random block sizes while several
+    reader threads use every read API at once. The value of each sample encodes
+    its absolute index and channel, so any window a reader gets can be checked:
+    a read that reports success must be internally consistent, and a read that
+    returns a torn window must have been flagged as overlapped.
+    
+    Before the rounds, the compact SampleFormats are checked against their
+    scalar code, and one last round runs on an Int16 ring.
+    
+    For ThreadSanitizer, build the Xcode ThreadSanitizer configuration. The
+    ring's sample data is deliberately read while it may be written (the reads
+    are validated afterwards, like a seqlock), so those copies are suppressed
+    in Main.cpp. All of the ring's counters are still checked.
+ */
+class RingBufferStressTest
+{
+public:
+    
+    /** Runs the stress test and prints a summary of every round to stdout.
+    
+        @returns    true if every read passed its checks
+     */
+    static bool run (int numRounds = 40)
+    {
+        const bool formatsPassed = checkSampleFormats();
+        int numFailedRounds = 0;
+        
+        std::cout << "RingBuffer: stress test, " << numRounds << " rounds and one Int16 round" << std::endl;
+        
+        for (int round = 0; round < numRounds; ++round)
+            if (! runRound<SampleFormats::Native<float>> (round, "float"))
+                ++numFailedRounds;
+        
+        if (! runRound<SampleFormats::Int16> (numRounds, "Int16"))
+            ++numFailedRounds;
+        
+        const bool passed = formatsPassed && numFailedRounds == 0;
+        
+        std::cout << (passed ? "PASSED" : "FAILED")
+                  << " (" << numFailedRounds << " failed rounds)" << std::endl;
+        
+        return passed;
+    }
+
+private:
+    
+    enum ReaderKind
+    {
+        latestView,     // getLatestView(), checked against its start index
+        latestCopy,     // readSamples()
+        consumer,       // readNewSamples(), checked for gaps
+        timedRead,      // readAt() some way behind the writer
+        numReaderKinds
+    };
+    
+    enum
+    {
+        // Every sample index times the channel count stays below 2^24, so the
+        // pattern is exact in a float
+        samplesPerRound = 1 << 21,
+        maxChannels = 4
+    };
+    
+    /** Passed as the start index when the read API doesn't report it. */
+    static constexpr int64 unknownStart = std::numeric_limits<int64>::min();
+    
+    /** Counts shared between the readers of a round. */
+    struct Counts
+    {
+        std::atomic<int64> reads { 0 };
+        std::atomic<int64> flagged { 0 };
+        std::atomic<int64> failures { 0 };
+    };
+    
+    //==========================================================================
+    /** Checks the compact formats' SIMD code against their scalar code, and
+        that samples come back within each format's precision. The block sizes
+        cover every remainder of the 4 and 8 sample SIMD blocks.
+     */
+    static bool checkSampleFormats()
+    {
+        const int numFailedBlocks = checkFormat<SampleFormats::Int16> (1.1f, 0.5f / 32767.0f, 1.0e-6f)
+                                  + checkFormat<SampleFormats::Float16> (1.0f, 1.0e-7f, 1.0f / 2048.0f);
+        
+        std::cout << "RingBuffer: sample formats, " << numFailedBlocks << " failed blocks" << std::endl;
+        
+        return numFailedBlocks == 0;
+    }
+    
+    /** Encodes, decodes and adds blocks of random samples in [-maxInput,
+        maxInput] in one call, and one sample at a time, which always takes the
+        scalar path. Both must give the same bits, and every decoded sample
+        must be within the error of the sample clipped to [-1, 1].
+        
+        @returns    the number of blocks that failed
+     */
+    template <class Format>
+    static int checkFormat (float maxInput, float absoluteError, float relativeError)
+    {
+        using StorageType = typename Format::StorageType;
+        
+        enum { maxBlockSize = 67 };
+        
+        Random random (0xf0a75);
+        HeapBlock<float> source (maxBlockSize), decoded (maxBlockSize), summed (maxBlockSize);
+        HeapBlock<float> scalarDecoded (maxBlockSize), scalarSummed (maxBlockSize);
+        HeapBlock<StorageType> encoded (maxBlockSize), scalarEncoded (maxBlockSize);
+        int numFailedBlocks = 0;
+        
+        for (int numSamples = 1; numSamples <= maxBlockSize; ++numSamples)
+        {
+            for (int i = 0; i < numSamples; ++i)
+                source[i] = maxInput * (2.0f * random.nextFloat() - 1.0f);
+            
+            Format::encode (source, encoded, numSamples);
+            Format::decode (encoded, decoded, numSamples);
+            FloatVectorOperations::copy (summed, source, numSamples);
+            Format::add (encoded, summed, numSamples);
+            
+            for (int i = 0; i < numSamples; ++i)
+            {
+                Format::encode (source + i, scalarEncoded + i, 1);
+                Format::decode (scalarEncoded + i, scalarDecoded + i, 1);
+                scalarSummed[i] = source[i];
+                Format::add (scalarEncoded + i, scalarSummed + i, 1);
+            }
+            
+            bool passed = std::memcmp (encoded, scalarEncoded, sizeof (StorageType) * (size_t) numSamples) == 0
+                       && std::memcmp (decoded, scalarDecoded, sizeof (float) * (size_t) numSamples) == 0
+                       && std::memcmp (summed, scalarSummed, sizeof (float) * (size_t) numSamples) == 0;
+            
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const float expected = jlimit (-1.0f, 1.0f, source[i]);
+                
+                if (std::abs (decoded[i] - expected) > absoluteError + relativeError * std::abs (expected))
+                    passed = false;
+            }
+            
+            if (! passed)
+                ++numFailedBlocks;
+        }
+        
+        return numFailedBlocks;
+    }
+    
+    /** The values the writer writes. Every sample holds a code that encodes
+        its channel and its index, and is stored as code / scale so that it
+        survives the ring's format exactly. In a compact format there are
+        fewer codes, so the indices repeat every indexPeriod samples.
+     */
+    struct Pattern
+    {
+        int numChannels;
+        float scale;
+        int64 indexPeriod;
+        
+        template <class Format>
+        static Pattern forFormat (int numChannels)
+        {
+            if (std::is_same<Format, SampleFormats::Int16>::value)
+                return { numChannels, 32767.0f, 32767 / numChannels };
+            
+            return { numChannels, 1.0f, samplesPerRound };
+        }
+        
+        /** The index modulo indexPeriod, which is what a window can tell. */
+        int64 wrap (int64 index) const
+        {
+            return ((index % indexPeriod) + indexPeriod) % indexPeriod;
+        }
+        
+        int64 codeOf (int channel, int64 index) const
+        {
+            return wrap (index) * numChannels + channel + 1;
+        }
+        
+        int64 codeOf (float value) const
+        {
+            return (int64) std::round (value * scale);
+        }
+        
+        /** The value written for a sample. */
+        float valueOf (int channel, int64 index) const
+        {
+            return (float) codeOf (channel, index) / scale;
+        }
+    };
+    
+    //==========================================================================
+    template <class Format>
+    static bool runRound (int round, const char* formatName)
+    {
+        Random random (0x57e55 + round);
+        
+        const int numChannels = 1 + random.nextInt (maxChannels);
+        const Pattern pattern = Pattern::forFormat<Format> (numChannels);
+        
+        // A torn window only shows up if the pattern doesn't repeat within
+        // the ring
+        int capacity = 1 << (8 + random.nextInt (7));
+        
+        while (capacity >= pattern.indexPeriod)
+            capacity /= 2;
+        
+        const int numReaders = 1 + random.nextInt (4);
+        const int maxBlockSize = jmax (1, capacity >> random.nextInt (5));
+        
+        RingBuffer<float, 0, 0, Format> ring (numChannels, capacity);
+        Counts counts;
+        
+        std::atomic<bool> writerDone { false };
+        std::atomic<int> readersReady { 0 };
+        std::vector<std::thread> readers;
+        
+        for (int r = 0; r < numReaders; ++r)
+        {
+            // Every round starts the cycle of kinds at a different one
+            const auto kind = (ReaderKind) ((round + r) % numReaderKinds);
+            const int64 readerSeed = random.nextInt64();
+            
+            readers.emplace_back ([&, kind, readerSeed]
+            {
+                // The writer waits for every reader to be ready, so nothing
+                // can be written between adding the consumer and recording
+                // where its cursor starts
+                const int consumerId = kind == consumer ? ring.addConsumer() : -1;
+                const int64 consumerStartIndex = ring.getTelemetry().samplesWritten;
+                
+                readersReady.fetch_add (1);
+                runReader (ring, pattern, kind, readerSeed, consumerId, consumerStartIndex, writerDone, counts);
+                
+                if (consumerId >= 0)
+                    ring.removeConsumer (consumerId);
+            });
+        }
+        
+        while (readersReady.load() < numReaders)
+            std::this_thread::yield();
+        
+        // The writer, on this thread
+        AudioBuffer<float> block (numChannels, maxBlockSize);
+        int64 writtenSamples = 0;
+        
+        while (writtenSamples < samplesPerRound)
+        {
+            const int blockSize = (int) jmin ((int64) 1 + random.nextInt (maxBlockSize),
+                                              samplesPerRound - writtenSamples);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    block.setSample (channel, i, pattern.valueOf (channel, writtenSamples + i));
+            
+            ring.writeSamples (block, 0, blockSize);
+            writtenSamples += blockSize;
+            
+            // Now and then let the readers catch up, so they see both calm and
+            // contended phases
+            if (random.nextInt (64) == 0)
+                std::this_thread::yield();
+        }
+        
+        writerDone.store (true, std::memory_order_release);
+        
+        for (auto& reader : readers)
+            reader.join();
+        
+        if (ring.getTelemetry().samplesWritten != writtenSamples)
+            counts.failures.fetch_add (1);
+        
+        std::cout << "    round " << round << ": " << formatName << ", " << numChannels
+                  << " channels, capacity " << ring.getBufferSize()
+                  << ", blocks up to " << maxBlockSize << ", " << numReaders << " readers | "
+                  << counts.reads.load() << " reads, " << counts.flagged.load() << " flagged, "
+                  << counts.failures.load() << " failures" << std::endl;
+        
+        return counts.failures.load() == 0;
+    }
+    
+    /** Keeps reading with one API until the writer is done. A consumer reader
+        reads with consumerId, whose cursor started at consumerStartIndex.
+     */
+    template <class RingBufferType>
+    static void runReader (RingBufferType& ring, const Pattern& pattern, ReaderKind kind, int64 seed,
+                           int consumerId, int64 consumerStartIndex,
+                           const std::atomic<bool>& writerDone, Counts& counts)
+    {
+        Random random (seed);
+        
+        const int numChannels = ring.getNumChannels();
+        const int maxReadSize = ring.getBufferSize() / 2;
+        AudioBuffer<float> window (numChannels, maxReadSize);
+        
+        int64 nextConsumerIndex = consumerStartIndex;
+        int64 pendingDroppedSamples = 0;
+        
+        while (! writerDone.load (std::memory_order_acquire))
+        {
+            const int readSize = 1 + random.nextInt (maxReadSize - 1);
+            bool intact = false;
+            int64 startIndex = unknownStart;
+            int numSamples = readSize;
+            
+            if (kind == latestView)
+            {
+                const auto view = ring.getLatestView (readSize);
+                
+                for (int channel = 0; channel < numChannels; ++channel)
+                    view.copyChannelTo (channel, window.getWritePointer (channel));
+                
+                intact = ring.isViewIntact (view);
+                startIndex = view.startIndex;
+            }
+            else if (kind == latestCopy)
+            {
+                intact = ring.readSamples (window, readSize);
+            }
+            else if (kind == consumer)
+            {
+                int64 droppedSamples = 0;
+                numSamples = ring.readNewSamples (consumerId, window, readSize, droppedSamples);
+                
+                // A read can skip dropped samples without returning any new ones
+                pendingDroppedSamples += droppedSamples;
+                
+                // Nothing new yet and an overwritten read look the same here,
+                // so neither is counted
+                if (numSamples == 0)
+                    continue;
+                
+                // Every sample must arrive exactly once, apart from the ones
+                // reported as dropped, starting with the first one written
+                // after the consumer was added
+                const int64 firstIndex = indexOf (pattern, window, 0);
+                
+                if (firstIndex != pattern.wrap (nextConsumerIndex + pendingDroppedSamples))
+                    counts.failures.fetch_add (1);
+                
+                nextConsumerIndex = firstIndex + numSamples;
+                pendingDroppedSamples = 0;
+                startIndex = firstIndex;
+                intact = true;
+            }
+            else if (kind == timedRead)
+            {
+                // Sometimes far enough behind that the window gets overwritten
+                const int64 behind = random.nextInt (ring.getBufferSize());
+                const int64 endIndex = ring.getTelemetry().samplesWritten - behind;
+                
+                // The end may be clamped to a later write count, so only the
+                // consistency of the window is checked
+                intact = ring.readAt (window, endIndex, readSize);
+            }
+            
+            counts.reads.fetch_add (1, std::memory_order_relaxed);
+            
+            if (! intact)
+            {
+                counts.flagged.fetch_add (1, std::memory_order_relaxed);
+                continue;
+            }
+            
+            if (! isConsistent (pattern, window, numSamples, startIndex))
+                counts.failures.fetch_add (1);
+        }
+    }
+    
+    //==========================================================================
+    /** The index of a sample read back, modulo the pattern's indexPeriod, or
+        -1 for the silence the ring holds before anything was written there.
+     */
+    static int64 indexOf (const Pattern& pattern, const AudioBuffer<float>& window, int sample)
+    {
+        const int64 code = pattern.codeOf (window.getSample (0, sample));
+        
+        if (code == 0)
+            return -1;
+        
+        return (code - 1) / pattern.numChannels;
+    }
+    
+    /** Returns true if the window holds consecutive samples, with all channels
+        from the same index. Only a run of silence from before the first write
+        may come first. Unless startIndex is unknownStart, the window must also
+        start there. Indices are compared modulo the pattern's indexPeriod.
+     */
+    static bool isConsistent (const Pattern& pattern, const AudioBuffer<float>& window,
+                              int numSamples, int64 startIndex)
+    {
+        const int numChannels = window.getNumChannels();
+        const bool hasStartIndex = startIndex != unknownStart;
+        bool started = false;
+        int64 expectedIndex = 0;
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const int64 index = indexOf (pattern, window, i);
+            
+            if (index < 0)
+            {
+                // Silence is only valid before sample 0
+                if (started || (hasStartIndex && startIndex + i >= 0))
+                    return false;
+                
+                for (int channel = 1; channel < numChannels; ++channel)
+                    if (window.getSample (channel, i) != 0.0f)
+                        return false;
+                
+                continue;
+            }
+            
+            if (! started)
+            {
+                // After silence the pattern must start at sample 0
+                if ((i > 0 && index != 0) || (hasStartIndex && index != pattern.wrap (startIndex + i)))
+                    return false;
+            }
+            else if (index != pattern.wrap (expectedIndex))
+            {
+                return false;
+            }
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                if (pattern.codeOf (window.getSample (channel, i)) != pattern.codeOf (channel, index))
+                    return false;
+            
+            started = true;
+            expectedIndex = index + 1;
+        }
+        
+        return true;
+    }
+};
+
+//==============================================================================
+#if defined (__has_feature)
+ #if __has_feature (thread_sanitizer)
+  #define RING_BUFFER_STRESS_TSAN 1
+ #endif
+#endif
@@ -0,0 +1,245 @@
+//
+//  STFT.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** A short-time Fourier transform that turns a stream of mono samples into a
+    steady stream of magnitude spectra.
+    
+    Every hopSize samples, the latest fftSize samples are multiplied by a
+    window and transformed. With a hop smaller than the FFT the windows
+    overlap, so frames arrive at sampleRate / hopSize per second while each
+    one still has the full frequency resolution of the FFT.
+    
+    The window is computed once into an aligned table, with the scaling that
+    makes a full scale sine peak at a magnitude of 1 folded in, so producing a
+    frame is one vector multiply and one FFT.
+    
+    A stereo pair can be analysed for about the cost of one channel with
+    pushStereoSamples(). Both channels are real, so they are packed into one
+    complex FFT, left as the real part and right as the imaginary part, and
+    the two spectra are separated again using the conjugate symmetry of real
+    signals' spectra.
+ */
+class STFT
+{
+public:
+    
+    using WindowingMethod = juce::dsp::WindowingFunction<float>::WindowingMethod;
+    
+    /** Creates the transform.
+    
+        @param fftOrder         the FFT size is 2^fftOrder samples
+        @param samplesPerHop    samples between the starts of consecutive
+                                frames, at most the FFT size
+        @param window           the window applied to every frame
+        @param kaiserBeta       the beta parameter, only used by the Kaiser
+                                window
+     */
+    STFT (int fftOrder, int samplesPerHop, WindowingMethod window = WindowingMethod::hann, float kaiserBeta = 6.0f)
+    :   fft (fftOrder),
+        fftSize (1 << fftOrder),
+        hopSize (samplesPerHop)
+    {
+        jassert (hopSize > 0 && hopSize <= fftSize);
+        
+        windowTable = allocateAligned (windowStorage, fftSize);
+        history = allocateAligned (historyStorage, 2 * fftSize);
+        rightHistory = allocateAligned (rightHistoryStorage, 2 * fftSize);
+        fftData = allocateAligned (fftDataStorage, 2 * fftSize);
+        fftOutput = allocateAligned (fftOutputStorage, 2 * fftSize);
+        
+        juce::dsp::WindowingFunction<float>::fillWindowingTables (windowTable, (size_t) fftSize, window, false, kaiserBeta);
+        
+        // Scale so that a full scale sine in the middle of a bin has a
+        // magnitude of 1: the window's sum is its gain, and a real sine's
+        // energy is split between the positive and negative frequencies
+        float windowSum = 0.0f;
+        
+        for (int i = 0; i < fftSize; ++i)
+            windowSum += windowTable[i];
+        
+        if (windowSum > 0.0f)
+            FloatVectorOperations::multiply (windowTable, 2.0f / windowSum, fftSize);
+        
+        reset();
+    }
+    
+    /** Forgets all previous samples, e.g. after a gap in the input. The next
+        frame is produced once a full FFT's worth of samples has arrived.
+     */
+    void reset()
+    {
+        FloatVectorOperations::clear (history, 2 * fftSize);
+        FloatVectorOperations::clear (rightHistory, 2 * fftSize);
+        historyPosition = 0;
+        samplesUntilNextFrame = fftSize;
+    }
+    
+    /** Adds samples to the stream, and calls onFrame for every frame they
+        complete.
+        
+        @param samples      the new mono samples
+        @param numSamples   how many there are
+        @param onFrame      called as onFrame (const float* magnitudes) with
+                            getNumBins() magnitudes, valid only during the call
+     */
+    template <class FrameCallback>
+    void pushSamples (const float* samples, int numSamples, FrameCallback&& onFrame)
+    {
+        while (numSamples > 0)
+        {
+            const int numToCopy = jmin (numSamples, samplesUntilNextFrame, fftSize - historyPosition);
+            
+            // The history is stored twice, back to back, so the latest fftSize
+            // samples are always contiguous no matter where the write position is
+            FloatVectorOperations::copy (history + historyPosition, samples, numToCopy);
+            FloatVectorOperations::copy (history + historyPosition + fftSize, samples, numToCopy);
+            
+            historyPosition = (historyPosition + numToCopy) & (fftSize - 1);
+            samplesUntilNextFrame -= numToCopy;
+            samples += numToCopy;
+            numSamples -= numToCopy;
+            
+            if (samplesUntilNextFrame == 0)
+            {
+                onFrame (computeFrame());
+                samplesUntilNextFrame = hopSize;
+            }
+        }
+    }
+    
+    /** Adds a stereo pair of channels to the stream, and calls onFrame for
+        every frame they complete. Don't mix this with pushSamples() without a
+        reset() in between.
+        
+        @param leftSamples      the new samples of the left channel
+        @param rightSamples     the new samples of the right channel
+        @param numSamples       how many there are in each channel
+        @param onFrame          called as onFrame (const float* leftMagnitudes,
+                                const float* rightMagnitudes) with getNumBins()
+                                magnitudes each, valid only during the call
+     */
+    template <class FrameCallback>
+    void pushStereoSamples (const float* leftSamples, const float* rightSamples, int numSamples, FrameCallback&& onFrame)
+    {
+        while (numSamples > 0)
+        {
+            const int numToCopy = jmin (numSamples, samplesUntilNextFrame, fftSize - historyPosition);
+            
+            FloatVectorOperations::copy (history + historyPosition, leftSamples, numToCopy);
+            FloatVectorOperations::copy (history + historyPosition + fftSize, leftSamples, numToCopy);
+            FloatVectorOperations::copy (rightHistory + historyPosition, rightSamples, numToCopy);
+            FloatVectorOperations::copy (rightHistory + historyPosition + fftSize, rightSamples, numToCopy);
+            
+            historyPosition = (historyPosition + numToCopy) & (fftSize - 1);
+            samplesUntilNextFrame -= numToCopy;
+            leftSamples += numToCopy;
+            rightSamples += numToCopy;
+            numSamples -= numToCopy;
+            
+            if (samplesUntilNextFrame == 0)
+            {
+                computeStereoFrame();
+                onFrame (fftData, fftData + fftSize);
+                samplesUntilNextFrame = hopSize;
+            }
+        }
+    }
+    
+    int getFftSize() const noexcept             { return fftSize; }
+    int getHopSize() const noexcept             { return hopSize; }
+    
+    /** Returns the number of magnitudes in every frame, from DC up to half
+        the sample rate.
+     */
+    int getNumBins() const noexcept             { return fftSize / 2 + 1; }
+    
+    /** Returns how many frames are produced per second of input. */
+    double getFrameRate (double sampleRate) const noexcept  { return sampleRate / hopSize; }
+
+private:
+    
+    /** Windows the latest fftSize samples and returns their magnitudes. */
+    const float* computeFrame()
+    {
+        // The oldest sample is at the write position
+        FloatVectorOperations::multiply (fftData, history + historyPosition, windowTable, fftSize);
+        FloatVectorOperations::clear (fftData + fftSize, fftSize);
+        
+        fft.performFrequencyOnlyForwardTransform (fftData);
+        return fftData;
+    }
+    
+    /** Windows the latest fftSize samples of both channels, and leaves the
+        left magnitudes at the start of fftData and the right ones at fftSize.
+     */
+    void computeStereoFrame()
+    {
+        using Complex = juce::dsp::Complex<float>;
+        
+        // z[n] = left[n] + i * right[n], both windowed
+        const float* left = history + historyPosition;
+        const float* right = rightHistory + historyPosition;
+        
+        for (int i = 0; i < fftSize; ++i)
+        {
+            fftData[2 * i]     = left[i] * windowTable[i];
+            fftData[2 * i + 1] = right[i] * windowTable[i];
+        }
+        
+        fft.perform (reinterpret_cast<const Complex*> (fftData), reinterpret_cast<Complex*> (fftOutput), false);
+        
+        // The spectrum of a real signal is conjugate symmetric, so with
+        // Z[k] = L[k] + i * R[k]:
+        //     L[k] = (Z[k] + conj (Z[N - k])) / 2
+        //     R[k] = (Z[k] - conj (Z[N - k])) / 2i
+        // Only the magnitudes are needed, so the division by i is dropped
+        const Complex* spectrum = reinterpret_cast<const Complex*> (fftOutput);
+        float* leftMagnitudes = fftData;
+        float* rightMagnitudes = fftData + fftSize;
+        
+        for (int k = 0; k < getNumBins(); ++k)
+        {
+            const Complex z = spectrum[k];
+            const Complex mirroredConj = std::conj (spectrum[(fftSize - k) & (fftSize - 1)]);
+            
+            leftMagnitudes[k] = 0.5f * std::abs (z + mirroredConj);
+            rightMagnitudes[k] = 0.5f * std::abs (z - mirroredConj);
+        }
+    }
+    
+    /** Allocates numFloats floats starting on a 64-byte boundary. */
+    static float* allocateAligned (HeapBlock<char>& storage, int numFloats)
+    {
+        storage.calloc (sizeof (float) * (size_t) numFloats + tableAlignment);
+        
+        return reinterpret_cast<float*> (((pointer_sized_int) storage.get() + tableAlignment - 1)
+                                           & ~((pointer_sized_int) tableAlignment - 1));
+    }
+    
+    enum { tableAlignment = 64 };
+    
+    juce::dsp::FFT fft;
+    const int fftSize;
+    const int hopSize;
+    
+    HeapBlock<char> windowStorage, historyStorage, rightHistoryStorage, fftDataStorage, fftOutputStorage;
+    float* windowTable;     // The window, scaled, see the constructor
+    float* history;         // The last fftSize samples, stored twice
+    float* rightHistory;    // The same for the right channel, only used in stereo
+    float* fftData;         // Twice the FFT size, as the FFT needs
+    float* fftOutput;       // The complex output of a stereo frame
+    
+    int historyPosition;
+    int samplesUntilNextFrame;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (STFT)
+};
@@ -0,0 +1,297 @@
+//
+//  SampleFormats.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define AUDIO_VISUALIZERS_USE_SSE2 1
+#endif
+
+#if defined (__F16C__)
+ #include <immintrin.h>
+ #define AUDIO_VISUALIZERS_USE_F16C 1
+#endif
+
+#ifndef GL_HALF_FLOAT
+ #define GL_HALF_FLOAT 0x140B
+#endif
+
+/** Storage formats for samples kept in a RingBuffer.
+
+    Each format describes how samples are packed in the ring (StorageType), how
+    to convert blocks of samples to and from it, and how to describe it to
+    glVertexAttribPointer() so the packed data can be uploaded to the GPU as is.
+    
+    Every format provides:
+        
+        encode (source, destination, numSamples)    samples -> storage
+        decode (source, destination, numSamples)    storage -> samples
+        add    (source, destination, numSamples)    destination += storage
+*/
+namespace SampleFormats
+{
+    /** Stores samples as they are, e.g. 32-bit floats. */
+    template <class Type>
+    struct Native
+    {
+        using StorageType = Type;
+        
+        static constexpr GLenum glDataType = std::is_same<Type, double>::value ? GL_DOUBLE : GL_FLOAT;
+        static constexpr GLboolean glNormalised = GL_FALSE;
+        
+        static void encode (const Type* source, StorageType* destination, int numSamples) noexcept
+        {
+            std::memcpy (destination, source, sizeof (Type) * (size_t) numSamples);
+        }
+        
+        static void decode (const StorageType* source, Type* destination, int numSamples) noexcept
+        {
+            std::memcpy (destination, source, sizeof (Type) * (size_t) numSamples);
+        }
+        
+        static void add (const StorageType* source, Type* destination, int numSamples) noexcept
+        {
+            FloatVectorOperations::add (destination, source, numSamples);
+        }
+    };
+    
+    //==========================================================================
+    /** Stores float samples in [-1, 1] as signed 16-bit integers. Samples
+        outside that range are clipped.
+        
+        On the GPU, use with normalised = GL_TRUE and the shader reads back
+        floats in [-1, 1].
+     */
+    struct Int16
+    {
+        using StorageType = int16;
+        
+        static constexpr GLenum glDataType = GL_SHORT;
+        static constexpr GLboolean glNormalised = GL_TRUE;
+        
+        static void encode (const float* source, StorageType* destination, int numSamples) noexcept
+        {
+            int i = 0;
+           
+           #if AUDIO_VISUALIZERS_USE_SSE2
+            // Clip before scaling so both ends saturate at +/-scale, like the
+            // scalar loop below. Packing alone would let -1 reach -32768.
+            const __m128 scaleVector = _mm_set1_ps (scale);
+            const __m128 minVector = _mm_set1_ps (-1.0f);
+            const __m128 maxVector = _mm_set1_ps (1.0f);
+            
+            const auto clipAndScale = [&] (const float* block)
+            {
+                return _mm_mul_ps (_mm_max_ps (_mm_min_ps (_mm_loadu_ps (block), maxVector), minVector), scaleVector);
+            };
+            
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                const __m128i low  = _mm_cvtps_epi32 (clipAndScale (source + i));
+                const __m128i high = _mm_cvtps_epi32 (clipAndScale (source + i + 4));
+                _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i), _mm_packs_epi32 (low, high));
+            }
+           #endif
+
+            // Rounds in the current rounding mode, ties to even by default, as
+            // _mm_cvtps_epi32 does, so a sample encodes the same on either path
+            for (; i < numSamples; ++i)
+                destination[i] = (StorageType) std::lrint (jlimit (-1.0f, 1.0f, source[i]) * scale);
+        }
+        
+        static void decode (const StorageType* source, float* destination, int numSamples) noexcept
+        {
+            int i = 0;
+           
+           #if AUDIO_VISUALIZERS_USE_SSE2
+            const __m128 inverseScaleVector = _mm_set1_ps (1.0f / scale);
+            
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                __m128 low, high;
+                unpack (source + i, inverseScaleVector, low, high);
+                _mm_storeu_ps (destination + i, low);
+                _mm_storeu_ps (destination + i + 4, high);
+            }
+           #endif
+
+            for (; i < numSamples; ++i)
+                destination[i] = (float) source[i] * (1.0f / scale);
+        }
+        
+        static void add (const StorageType* source, float* destination, int numSamples) noexcept
+        {
+            int i = 0;
+           
+           #if AUDIO_VISUALIZERS_USE_SSE2
+            const __m128 inverseScaleVector = _mm_set1_ps (1.0f / scale);
+            
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                __m128 low, high;
+                unpack (source + i, inverseScaleVector, low, high);
+                _mm_storeu_ps (destination + i, _mm_add_ps (_mm_loadu_ps (destination + i), low));
+                _mm_storeu_ps (destination + i + 4, _mm_add_ps (_mm_loadu_ps (destination + i + 4), high));
+            }
+           #endif
+
+            for (; i < numSamples; ++i)
+                destination[i] += (float) source[i] * (1.0f / scale);
+        }
+    
+    private:
+        static constexpr float scale = 32767.0f;
+       
+       #if AUDIO_VISUALIZERS_USE_SSE2
+        /** Converts 8 packed samples into two vectors of 4 floats. */
+        static void unpack (const StorageType* source, __m128 inverseScaleVector, __m128& low, __m128& high) noexcept
+        {
+            const __m128i packed = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source));
+            
+            // Sign extend to 32 bits by moving each sample into the top half
+            // and shifting it back down arithmetically
+            low  = _mm_mul_ps (_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (packed, packed), 16)), inverseScaleVector);
+            high = _mm_mul_ps (_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (packed, packed), 16)), inverseScaleVector);
+        }
+       #endif
+    };
+    
+    //==========================================================================
+    /** Stores float samples as IEEE 754 half precision floats.
+    
+        On the GPU, use as GL_HALF_FLOAT and the shader reads back floats.
+     */
+    struct Float16
+    {
+        using StorageType = uint16;
+        
+        static constexpr GLenum glDataType = GL_HALF_FLOAT;
+        static constexpr GLboolean glNormalised = GL_FALSE;
+        
+        static void encode (const float* source, StorageType* destination, int numSamples) noexcept
+        {
+            int i = 0;
+           
+           #if AUDIO_VISUALIZERS_USE_F16C
+            for (; i + 8 <= numSamples; i += 8)
+                _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i),
+                                  _mm256_cvtps_ph (_mm256_loadu_ps (source + i), _MM_FROUND_TO_NEAREST_INT));
+           #endif
+
+            for (; i < numSamples; ++i)
+                destination[i] = floatToHalf (source[i]);
+        }
+        
+        static void decode (const StorageType* source, float* destination, int numSamples) noexcept
+        {
+            int i = 0;
+           
+           #if AUDIO_VISUALIZERS_USE_F16C
+            for (; i + 8 <= numSamples; i += 8)
+                _mm256_storeu_ps (destination + i,
+                                  _mm256_cvtph_ps (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + i))));
+           #endif
+
+            for (; i < numSamples; ++i)
+                destination[i] = halfToFloat (source[i]);
+        }
+        
+        static void add (const StorageType* source, float* destination, int numSamples) noexcept
+        {
+            int i = 0;
+           
+           #if AUDIO_VISUALIZERS_USE_F16C
+            for (; i + 8 <= numSamples; i += 8)
+                _mm256_storeu_ps (destination + i,
+                                  _mm256_add_ps (_mm256_loadu_ps (destination + i),
+                                                 _mm256_cvtph_ps (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + i)))));
+           #endif
+
+            for (; i < numSamples; ++i)
+                destination[i] += halfToFloat (source[i]);
+        }
+        
+        /** Converts a float to half precision, rounding to nearest even. Used
+            where F16C is unavailable, and for the tail of each block.
+         */
+        static StorageType floatToHalf (float value) noexcept
+        {
+            uint32 bits;
+            std::memcpy (&bits, &value, sizeof (bits));
+            
+            const uint32 sign = bits & 0x80000000u;
+            bits ^= sign;
+            
+            uint32 result;
+            
+            if (bits >= (127u + 16u) << 23)                // Too large, Inf or NaN
+            {
+                result = bits > (255u << 23) ? 0x7e00u : 0x7c00u;
+            }
+            else if (bits < (113u << 23))                  // Subnormal or zero
+            {
+                // Adding a magic number lines the 10 mantissa bits up at the
+                // bottom of the float, and the FPU does the rounding
+                const uint32 denormalMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+                float denormalMagic, shifted;
+                std::memcpy (&denormalMagic, &denormalMagicBits, sizeof (denormalMagic));
+                std::memcpy (&shifted, &bits, sizeof (shifted));
+                
+                shifted += denormalMagic;
+                std::memcpy (&result, &shifted, sizeof (result));
+                result -= denormalMagicBits;
+            }
+            else                                            // Normal
+            {
+                const uint32 mantissaIsOdd = (bits >> 13) & 1u;
+                bits += ((uint32) (15 - 127) << 23) + 0xfffu + mantissaIsOdd;
+                result = bits >> 13;
+            }
+            
+            return (StorageType) (result | (sign >> 16));
+        }
+        
+        /** Converts a half precision float back to a float. */
+        static float halfToFloat (StorageType half) noexcept
+        {
+            const uint32 shiftedExponent = 0x7c00u << 13;
+            uint32 bits = ((uint32) half & 0x7fffu) << 13;
+            const uint32 exponent = shiftedExponent & bits;
+            
+            bits += (127u - 15u) << 23;
+            
+            if (exponent == shiftedExponent)                // Inf or NaN
+            {
+                bits += (128u - 16u) << 23;
+            }
+            else if (exponent == 0)                         // Subnormal or zero
+            {
+                const uint32 magicBits = 113u << 23;
+                float magic, renormalised;
+                std::memcpy (&magic, &magicBits, sizeof (magic));
+                
+                bits += 1u << 23;
+                std::memcpy (&renormalised, &bits, sizeof (renormalised));
+                renormalised -= magic;
+                std::memcpy (&bits, &renormalised, sizeof (bits));
+            }
+            
+            bits |= ((uint32) half & 0x8000u) << 16;
+            
+            float result;
+            std::memcpy (&result, &bits, sizeof (result));
+            return result;
+        }
+    };
+}
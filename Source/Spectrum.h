@@ -9,11 +9,22 @@
 #pragma once
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "GLResources.h"
 #include "RingBuffer.h"
+#include "SpectrumAnalyser.h"
 
 /** Frequency Spectrum visualizer. Uses basic shaders, and calculates all points
     on the CPU as opposed to the OScilloscope3D which calculates points on the
     GPU.
+    
+    The spectrum is drawn either as a grid of points, or as a continuous surface
+    made of one triangle strip over the same vertices. The strip's index buffer
+    is built once, so only the heights stream to the GPU every frame.
+    
+    The history of rows is a circular buffer on the GPU. Each new row overwrites
+    the oldest one in place, and the vertex shader moves every row back by its
+    age relative to the head row, so adding a row costs the same however many
+    rows are shown.
  */
 
 class Spectrum :    public Component,
@@ -22,9 +33,22 @@ class Spectrum :    public Component,
 {
     
 public:
-    Spectrum (RingBuffer<GLfloat> * ringBuffer)
-    :   readBuffer (2, RING_BUFFER_READ_SIZE),
-        forwardFFT (fftOrder)
+    /** How the grid of vertices is drawn. */
+    enum class DrawMode
+    {
+        points,     // A point at every vertex
+        surface     // A continuous surface through all vertices
+    };
+    
+    /** Creates the Spectrum.
+    
+        @param ringBuffer       the audio to show
+        @param channelLayout    mono sums the channels across the whole width,
+                                stereoSplit shows left and right as mirrored
+                                halves, with the low frequencies in the middle
+     */
+    Spectrum (VisualizerRingBuffer * ringBuffer,
+              SpectrumAnalyser::ChannelLayout channelLayout = SpectrumAnalyser::ChannelLayout::mono)
     {
         // Sets the version to 3.2
         openGLContext.setOpenGLVersionRequired (OpenGLContext::OpenGLVersion::openGL3_2);
@@ -34,8 +58,18 @@ public:
         // Set default 3D orientation
         draggableOrientation.reset(Vector3D<float>(0.0, 1.0, 0.0));
         
-        // Allocate FFT data
-        fftData = new GLfloat [2 * fftSize];
+        // Setup Sizing Variables
+        xFreqWidth = 3.0f;
+        yAmpHeight = 1.0f;
+        zTimeDepth = 3.0f;
+        xFreqResolution = 50;
+        zTimeResolution = 60;
+        
+        // The FFT runs on its own thread and hands us one row per hop
+        analyser = std::make_unique<SpectrumAnalyser> (*ringBuffer, xFreqResolution, RING_BUFFER_READ_SIZE,
+                                                       STFT::WindowingMethod::hann,
+                                                       SpectrumAnalyser::BandReduction::peak,
+                                                       channelLayout);
         
         // Attach the OpenGL context but do not start [ see start() ]
         openGLContext.setRenderer(this);
@@ -53,7 +87,8 @@ public:
         openGLContext.setContinuousRepainting (false);
         openGLContext.detach();
         
-        delete [] fftData;
+        // Stop analysing before we let go of the ringBuffer
+        analyser = nullptr;
         
         // Detach ringBuffer
         ringBuffer = nullptr;
@@ -69,12 +104,47 @@ public:
     
     void start()
     {
+        analyser->startThread();
         openGLContext.setContinuousRepainting (true);
     }
     
     void stop()
     {
         openGLContext.setContinuousRepainting (false);
+        analyser->stopThread (500);
+    }
+    
+    /** Sets the FFT size to 2^order samples, from 2^8 to 2^16. Small sizes
+        follow transients closely, large ones resolve the bass. Can be called
+        while running, nothing is allocated to switch.
+     */
+    void setFftOrder (int order)
+    {
+        analyser->setFftOrder (order);
+    }
+    
+    /** Switches how the frequencies are spread across the width, e.g. to a
+        constant Q or mel filterbank. Can be called while running.
+     */
+    void setFrequencyScale (SpectrumAnalyser::FrequencyScale scale)
+    {
+        analyser->setFrequencyScale (scale);
+    }
+    
+    /** Sets how the spectrum is smoothed over time and scaled, see
+        SpectrumDynamics. Can be called while running.
+     */
+    void setDynamics (const SpectrumDynamics::Settings& settings)
+    {
+        analyser->setDynamics (settings);
+    }
+    
+    /** Switches between drawing points and a surface. Can be called while
+        running.
+     */
+    void setDrawMode (DrawMode newDrawMode)
+    {
+        drawMode = newDrawMode;
     }
     
     
@@ -87,14 +157,9 @@ public:
      */
     void newOpenGLContextCreated() override
     {
-        // Setup Sizing Variables
-        xFreqWidth = 3.0f;
-        yAmpHeight = 1.0f;
-        zTimeDepth = 3.0f;
-        xFreqResolution = 50;
-        zTimeResolution = 60;
-
         numVertices = xFreqResolution * zTimeResolution;
+        numStoredVertices = numVertices + xFreqResolution;
+        headRow = 0;
         
         // Initialize XZ Vertices
         initializeXZVertices();
@@ -103,25 +168,34 @@ public:
         initializeYVertices();
         
         // Setup Buffer Objects
-        openGLContext.extensions.glGenBuffers (1, &xzVBO); // Vertex Buffer Object
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, xzVBO);
-        openGLContext.extensions.glBufferData (GL_ARRAY_BUFFER, sizeof(GLfloat) * numVertices * 2, xzVertices, GL_STATIC_DRAW);
+        xzVBO.create (openGLContext, GL_ARRAY_BUFFER); // Vertex Buffer Object
+        xzVBO.upload (xzVertices, sizeof(GLfloat) * numStoredVertices * 2, GL_STATIC_DRAW);
         
         
-        openGLContext.extensions.glGenBuffers (1, &yVBO);
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, yVBO);
-        openGLContext.extensions.glBufferData (GL_ARRAY_BUFFER, sizeof(GLfloat) * numVertices, yVertices, GL_STREAM_DRAW);
+        yVBO.create (openGLContext, GL_ARRAY_BUFFER);
+        yVBO.upload (yVertices, sizeof(GLfloat) * numStoredVertices, GL_STREAM_DRAW);
         
-        openGLContext.extensions.glGenVertexArrays(1, &VAO);
-        openGLContext.extensions.glBindVertexArray(VAO);
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, xzVBO);
+        VAO.create (openGLContext);
+        VAO.bind();
+        xzVBO.bind();
         openGLContext.extensions.glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), NULL);
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, yVBO);
+        yVBO.bind();
         openGLContext.extensions.glVertexAttribPointer (1, 1, GL_FLOAT, GL_FALSE, sizeof(GLfloat), NULL);
         
         openGLContext.extensions.glEnableVertexAttribArray (0);
         openGLContext.extensions.glEnableVertexAttribArray (1);
         
+        // The surface's indices never change, only the heights they point to,
+        // so they are uploaded once. Bound while the VAO is, so it keeps them.
+        initializeSurfaceIndices();
+        
+        EBO.create (openGLContext, GL_ELEMENT_ARRAY_BUFFER);
+        EBO.upload (surfaceIndices, sizeof(GLuint) * numSurfaceIndices, GL_STATIC_DRAW);
+        
+        VAO.unbind();
+        yVBO.unbind();
+        EBO.unbind();
+        
         glPointSize (6.0f);
         
         // Setup Shaders
@@ -133,11 +207,17 @@ public:
      */
     void openGLContextClosing() override
     {
-        shader.release();
-        uniforms.release();
+        uniforms.reset();
+        shader.reset();
+        
+        VAO.release();
+        xzVBO.release();
+        yVBO.release();
+        EBO.release();
         
         delete [] xzVertices;
         delete [] yVertices;
+        delete [] surfaceIndices;
     }
     
     
@@ -162,53 +242,33 @@ public:
         shader->use();
         
         
-        // Copy data from ring buffer into FFT
-        
-        ringBuffer->readSamples (readBuffer, RING_BUFFER_READ_SIZE);
-        FloatVectorOperations::clear (fftData, RING_BUFFER_READ_SIZE);
+        // Pick up the newest row from the analysis thread, and only add a new
+        // row to the spectrum if there is one
+        auto& frames = analyser->getFrames();
         
-        /** Future Feature:
-            Instead of summing channels below, keep the channels seperate and
-            lay out the spectrum so you can see the left and right channels
-            individually on either half of the spectrum.
-         */
-        // Sum channels together
-        for (int i = 0; i < 2; ++i)
+        if (frames.update())
         {
-            FloatVectorOperations::add (fftData, readBuffer.getReadPointer(i, 0), RING_BUFFER_READ_SIZE);
-        }
-        
-        // Calculate FFT Crap
-        forwardFFT.performFrequencyOnlyForwardTransform (fftData);
-        
-        // Find the range of values produced, so we can scale our rendering to
-        // show up the detail clearly
-        Range<float> maxFFTLevel = FloatVectorOperations::findMinAndMax (fftData, fftSize / 2);
+            const std::vector<float>& levels = frames.getReadFrame().levels;
+            const std::vector<float>& peaks = frames.getReadFrame().peaks;
         
-        // Calculate new y values and shift old y values back
-        for (int i = numVertices; i >= 0; --i)
-        {
-            // For the first row of points, render the new height via the FFT
-            if (i < xFreqResolution)
-            {
-                const float skewedProportionY = 1.0f - std::exp (std::log (i / ((float) xFreqResolution - 1.0f)) * 0.2f);
-                const int fftDataIndex = jlimit (0, fftSize / 2, (int) (skewedProportionY * fftSize / 2));
-                float level = 0.0f;
-                
-                if (maxFFTLevel.getEnd() != 0.0f)
-                    level = jmap (fftData[fftDataIndex], 0.0f, maxFFTLevel.getEnd(), 0.0f, yAmpHeight);
-                
-                yVertices[i] = level;
-            }
-            else // For the subsequent rows, shift back
+            // The new row replaces the oldest one, which becomes the head
+            headRow = (headRow + zTimeResolution - 1) % zTimeResolution;
+            GLfloat* newRow = yVertices + headRow * xFreqResolution;
+            GLfloat* peakRow = yVertices + numVertices;
+            
+            for (int i = 0; i < xFreqResolution; ++i)
             {
-                yVertices[i] = yVertices[i - xFreqResolution];
+                newRow[i] = levels[(size_t) i] * yAmpHeight;
+                peakRow[i] = peaks[(size_t) i] * yAmpHeight;
             }
+            
+            // Only upload the new row and the peaks, the shader takes care of
+            // moving the others back
+            yVBO.update (newRow, sizeof(GLfloat) * headRow * xFreqResolution, sizeof(GLfloat) * xFreqResolution);
+            yVBO.update (peakRow, sizeof(GLfloat) * numVertices, sizeof(GLfloat) * xFreqResolution);
+            yVBO.unbind();
         }
         
-        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, yVBO);
-        openGLContext.extensions.glBufferData (GL_ARRAY_BUFFER, sizeof(GLfloat) * numVertices, yVertices, GL_STREAM_DRAW);
-        
         
         // Setup the Uniforms for use in the Shader
         if (uniforms->projectionMatrix != nullptr)
@@ -224,19 +284,54 @@ public:
             uniforms->viewMatrix->setMatrix4 (finalMatrix.mat, 1, false);
             
         }
+        
+        if (uniforms->headRow != nullptr)
+            uniforms->headRow->set ((GLint) headRow);
+        
+        if (uniforms->numRows != nullptr)
+            uniforms->numRows->set ((GLint) zTimeResolution);
+        
+        if (uniforms->rowLength != nullptr)
+            uniforms->rowLength->set ((GLint) xFreqResolution);
+        
+        if (uniforms->zRowSpacing != nullptr)
+            uniforms->zRowSpacing->set (zTimeDepth / ((GLfloat) zTimeResolution - 1.0f));
 
-        // Draw the points
-        openGLContext.extensions.glBindVertexArray(VAO);
-        glDrawArrays (GL_POINTS, 0, numVertices);
+        const bool drawSurface = drawMode == DrawMode::surface;
+        
+        if (uniforms->shadeByHeight != nullptr)
+            uniforms->shadeByHeight->set (drawSurface ? 1.0f : 0.0f);
         
+        VAO.bind();
         
-        // Zero Out FFT for next use
-        zeromem (fftData, sizeof (GLfloat) * 2 * fftSize);
+        if (drawSurface)
+        {
+            // The surface hides parts of itself, so it needs the depth test
+            glEnable (GL_DEPTH_TEST);
+            
+            // The strip between the oldest row and the newest one would join
+            // the back of the history to the front, so draw the strips before
+            // and after it as two ranges
+            const int seamStrip = (headRow + zTimeResolution - 1) % zTimeResolution;
+            drawSurfaceStrips (0, seamStrip);
+            drawSurfaceStrips (seamStrip + 1, zTimeResolution);
+            
+            glDisable (GL_DEPTH_TEST);
+        }
+        else
+        {
+            // Draw the points
+            glDrawArrays (GL_POINTS, 0, numVertices);
+        }
+        
+        // The held peaks, as a line over the newest row in the plain colour
+        if (uniforms->shadeByHeight != nullptr)
+            uniforms->shadeByHeight->set (0.0f);
+        
+        glDrawArrays (GL_LINE_STRIP, numVertices, xFreqResolution);
         
-        // Reset the element buffers so child Components draw correctly
-//        openGLContext.extensions.glBindBuffer (GL_ARRAY_BUFFER, 0);
-//        openGLContext.extensions.glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
-//        openGLContext.extensions.glBindVertexArray(0);
+        // Reset the vertex array so child Components draw correctly
+        VAO.unbind();
     }
     
     
@@ -266,11 +361,13 @@ private:
     //==========================================================================
     // Mesh Functions
     
-    // Initialize the XZ values of vertices
+    // Initialize the XZ values of vertices. These are the positions with the
+    // head row at row 0, the shader moves the rows as the head moves. The row
+    // of peaks after the surface is moved to the front by the shader.
     void initializeXZVertices()
     {
         
-        int numFloatsXZ = numVertices * 2;
+        int numFloatsXZ = numStoredVertices * 2;
         
         xzVertices = new GLfloat [numFloatsXZ];
         
@@ -294,12 +391,46 @@ private:
         }
     }
     
+    /** Initialize the indices of the surface.
+    
+        There is one strip of triangles between every row and the next,
+        including the last row and the first, as the rows are circular. All
+        strips are joined into a single triangle strip by repeating the first
+        and last index of every strip, which makes degenerate triangles that
+        aren't drawn. Every strip has the same number of indices, so any range
+        of strips can be drawn on its own, see drawSurfaceStrips().
+     */
+    void initializeSurfaceIndices()
+    {
+        numIndicesPerStrip = 2 * xFreqResolution + 2;
+        numSurfaceIndices = numIndicesPerStrip * zTimeResolution;
+        surfaceIndices = new GLuint [numSurfaceIndices];
+        
+        GLuint* index = surfaceIndices;
+        
+        for (int row = 0; row < zTimeResolution; ++row)
+        {
+            const GLuint rowStart = (GLuint) (row * xFreqResolution);
+            const GLuint nextRowStart = (GLuint) (((row + 1) % zTimeResolution) * xFreqResolution);
+            
+            *index++ = rowStart;
+            
+            for (int x = 0; x < xFreqResolution; ++x)
+            {
+                *index++ = rowStart + (GLuint) x;
+                *index++ = nextRowStart + (GLuint) x;
+            }
+            
+            *index++ = nextRowStart + (GLuint) (xFreqResolution - 1);
+        }
+    }
+    
     // Initialize the Y valies of vertices
     void initializeYVertices()
     {
         // Set all Y values to 0.0
-        yVertices = new GLfloat [numVertices];
-        memset(yVertices, 0.0f, sizeof(GLfloat) * xFreqResolution * zTimeResolution);
+        yVertices = new GLfloat [numStoredVertices];
+        memset(yVertices, 0.0f, sizeof(GLfloat) * numStoredVertices);
     }
     
     
@@ -325,6 +456,19 @@ private:
         return rotationMatrix * viewMatrix;
     }
     
+    /** Draws the strips of the surface starting at rows startRow up to, but
+        not including, endRow.
+     */
+    void drawSurfaceStrips (int startRow, int endRow)
+    {
+        if (endRow <= startRow)
+            return;
+        
+        const size_t firstIndex = (size_t) (startRow * numIndicesPerStrip);
+        glDrawElements (GL_TRIANGLE_STRIP, (endRow - startRow) * numIndicesPerStrip, GL_UNSIGNED_INT,
+                        (const GLvoid*) (firstIndex * sizeof (GLuint)));
+    }
+    
     /** Loads the OpenGL Shaders and sets up the whole ShaderProgram
      */
     void createShaders()
@@ -336,20 +480,38 @@ private:
         // Uniforms
         "uniform mat4 projectionMatrix;\n"
         "uniform mat4 viewMatrix;\n"
+        "uniform int headRow;\n"
+        "uniform int numRows;\n"
+        "uniform int rowLength;\n"
+        "uniform float zRowSpacing;\n"
+        "\n"
+        "out float height;\n"
         "\n"
         "void main()\n"
         "{\n"
-        "    gl_Position = projectionMatrix * viewMatrix * vec4(xzPos[0], yPos, xzPos[1], 1.0f);\n"
+        "    height = yPos;\n"
+        // The history is circular: the row a vertex is stored in is not its
+        // age, so move it back to where its age puts it. The row of peaks
+        // after the history goes over the newest row.
+        "    int row = gl_VertexID / rowLength;\n"
+        "    int age = row < numRows ? (row - headRow + numRows) % numRows : 0;\n"
+        "    float z = xzPos[1] + float(age - row) * zRowSpacing;\n"
+        "    gl_Position = projectionMatrix * viewMatrix * vec4(xzPos[0], yPos, z, 1.0f);\n"
         "}\n";
    
         
         // Base Shader
         fragmentShader =
         "#version 330 core\n"
+        "in float height;\n"
+        "uniform float shadeByHeight;\n"
         "out vec4 color;\n"
         "void main()\n"
         "{\n"
-        "    color = vec4 (1.0f, 0.0f, 2.0f, 1.0f);\n"
+        // A surface in one flat colour has no visible shape, so it's darker
+        // where it's low. The levels are in [0, 1].
+        "    float shade = mix (1.0f, 0.3f + 0.7f * clamp (height, 0.0f, 1.0f), shadeByHeight);\n"
+        "    color = vec4 (vec3 (1.0f, 0.0f, 2.0f) * shade, 1.0f);\n"
         "}\n";
         
 
@@ -359,7 +521,7 @@ private:
             && shaderProgramAttempt->addFragmentShader ((fragmentShader))
             && shaderProgramAttempt->link())
         {
-            uniforms.release();
+            uniforms.reset();
             shader = std::move (shaderProgramAttempt);
             uniforms.reset (new Uniforms (openGLContext, *shader));
             
@@ -381,9 +543,15 @@ private:
         {
             projectionMatrix.reset (createUniform (openGLContext, shaderProgram, "projectionMatrix"));
             viewMatrix.reset (createUniform (openGLContext, shaderProgram, "viewMatrix"));
+            headRow.reset (createUniform (openGLContext, shaderProgram, "headRow"));
+            numRows.reset (createUniform (openGLContext, shaderProgram, "numRows"));
+            rowLength.reset (createUniform (openGLContext, shaderProgram, "rowLength"));
+            zRowSpacing.reset (createUniform (openGLContext, shaderProgram, "zRowSpacing"));
+            shadeByHeight.reset (createUniform (openGLContext, shaderProgram, "shadeByHeight"));
         }
         
         std::unique_ptr<OpenGLShaderProgram::Uniform> projectionMatrix, viewMatrix;
+        std::unique_ptr<OpenGLShaderProgram::Uniform> headRow, numRows, rowLength, zRowSpacing, shadeByHeight;
         //ScopedPointer<OpenGLShaderProgram::Uniform> lightPosition;
         
     private:
@@ -406,15 +574,23 @@ private:
     int zTimeResolution;
     
     int numVertices;
+    int numStoredVertices;  // The surface's, then one row of held peaks
     GLfloat * xzVertices;
-    GLfloat * yVertices;
+    GLfloat * yVertices;    // Circular, row headRow is the newest
+    int headRow;
+    
+    int numIndicesPerStrip;
+    int numSurfaceIndices;
+    GLuint * surfaceIndices;
+    std::atomic<DrawMode> drawMode { DrawMode::surface };
     
     
     // OpenGL Variables
     OpenGLContext openGLContext;
-    GLuint xzVBO;
-    GLuint yVBO;
-    GLuint VAO;/*, EBO;*/
+    GLBuffer xzVBO;
+    GLBuffer yVBO;
+    GLVertexArray VAO;
+    GLBuffer EBO;
     
     std::unique_ptr<OpenGLShaderProgram> shader;
     std::unique_ptr<Uniforms> uniforms;
@@ -427,17 +603,8 @@ private:
     Draggable3DOrientation draggableOrientation;
     
     // Audio Structures
-    RingBuffer<GLfloat> * ringBuffer;
-    AudioBuffer<GLfloat> readBuffer;    // Stores data read from ring buffer
-    juce::dsp::FFT forwardFFT;
-    GLfloat * fftData;
-    
-    // This is so that we can initialize fowardFFT in the constructor with the order
-    enum
-    {
-        fftOrder = 10,
-        fftSize  = 1 << fftOrder // set 10th bit to one
-    };
+    VisualizerRingBuffer * ringBuffer;
+    std::unique_ptr<SpectrumAnalyser> analyser;
     
     // Overlay GUI
     String statusText;
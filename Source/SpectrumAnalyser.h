@@ -0,0 +1,499 @@
+//
+//  SpectrumAnalyser.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "RingBuffer.h"
+#include "Filterbank.h"
+#include "SpectrumDynamics.h"
+#include "STFT.h"
+#include "TripleBuffer.h"
+#include <algorithm>
+#include <vector>
+
+/** Runs the Spectrum's FFT analysis on its own thread.
+
+    The thread pulls every new sample from the ring buffer, runs a windowed,
+    overlapping STFT over them, and reduces every frame to one level per band
+    of the display. The finished rows are published through a TripleBuffer, so
+    the render thread only picks up the newest row and draws it. Analysis
+    therefore runs at the hop rate no matter how fast or slow the frames are
+    rendered.
+    
+    Every frame's bands are smoothed over time and scaled by SpectrumDynamics
+    at the hop rate, see setDynamics(). Every published row then holds the
+    loudest smoothed levels since the renderer picked up the previous one, so
+    short transients are not lost between frames.
+    
+    The FFT size can be changed while running with setFftOrder(). An STFT and
+    band map for every supported size is built up front, so switching is only
+    a matter of picking another one and never allocates on the analysis thread.
+    
+    By default the bands are the FFT's bins grouped on a skewed scale. A
+    Filterbank can be used instead with setFrequencyScale(), which spaces the
+    bands musically (constant Q, mel or third octave). Its kernels are built
+    up front for every FFT size, so the scale too can be switched at any time.
+    
+    With ChannelLayout::stereoSplit the left and right channels are analysed
+    separately, with one packed FFT for both, and share the row as mirrored
+    halves: the left channel runs from high to low frequencies up to the middle
+    of the row, and the right channel from low to high after it.
+ */
+class SpectrumAnalyser : public Thread
+{
+public:
+    
+    /** How the bins that fall into one band are reduced to its level. */
+    enum class BandReduction
+    {
+        peak,   // The loudest bin, so narrow peaks between bands still show
+        rms     // The RMS of all bins, a smoother measure of the band's energy
+    };
+    
+    /** How the bands are spread over the frequencies. */
+    enum class FrequencyScale
+    {
+        skewed,         // The FFT bins on a skewed scale, reduced with the BandReduction
+        constantQ,      // A Filterbank with these scales, see Filterbank::Scale
+        mel,
+        thirdOctave
+    };
+    
+    /** Which channels the row shows. */
+    enum class ChannelLayout
+    {
+        mono,           // All channels summed, across the whole row
+        stereoSplit     // Left on the first half, right mirrored on the second
+    };
+    
+    /** One row of the spectrum, ready to draw. */
+    struct Frame
+    {
+        std::vector<float> levels;      // One level in [0, 1] per band
+        std::vector<float> peaks;       // The held peak of every band, also in [0, 1]
+    };
+    
+    /** Creates the analyser, it does nothing until startThread() is called.
+    
+        @param ringBufferToAnalyse  the ring to analyse, it must outlive the
+                                    analyser
+        @param numBandsPerRow       the number of levels in every published row
+        @param samplesPerHop        the number of new samples between frames.
+                                    Sets the analysis rate, e.g. 256 samples at
+                                    48kHz is 187.5 rows per second. Large FFTs
+                                    use a longer hop, so that no more than
+                                    maxFramesPerFft frames overlap.
+        @param window               the window applied to every frame
+        @param reduction            how the bins of each band are combined
+        @param layout               which channels the row shows. For
+                                    stereoSplit, numBandsPerRow should be even.
+     */
+    SpectrumAnalyser (VisualizerRingBuffer& ringBufferToAnalyse, int numBandsPerRow,
+                      int samplesPerHop = defaultHopSize,
+                      STFT::WindowingMethod window = STFT::WindowingMethod::hann,
+                      BandReduction reduction = BandReduction::peak,
+                      ChannelLayout layout = ChannelLayout::mono)
+    :   Thread ("Spectrum Analyser"),
+        ringBuffer (ringBufferToAnalyse),
+        numBands (numBandsPerRow),
+        channelLayout (layout),
+        numBandsPerChannel (layout == ChannelLayout::stereoSplit ? numBandsPerRow / 2 : numBandsPerRow),
+        bandReduction (reduction),
+        sampleRate (ringBufferToAnalyse.getSampleRate() > 0.0 ? ringBufferToAnalyse.getSampleRate()
+                                                              : (double) fallbackSampleRate),
+        dynamics (numBandsPerRow),
+        frames (Frame { std::vector<float> ((size_t) numBandsPerRow, 0.0f),
+                        std::vector<float> ((size_t) numBandsPerRow, 0.0f) })
+    {
+        // Get our own read cursor so every sample is analysed exactly once
+        ringBufferConsumer = ringBuffer.addConsumer();
+        
+        jassert (layout == ChannelLayout::mono || numBandsPerRow % 2 == 0);
+        
+        // Build every FFT size we can switch to now, so switching later
+        // doesn't allocate. The filterbanks need the sample rate, so the
+        // device should be set up before the analyser is created.
+        for (int order = minFftOrder; order <= maxFftOrder; ++order)
+        {
+            const int fftSize = 1 << order;
+            const int hopSize = jlimit (fftSize / maxFramesPerFft, fftSize, samplesPerHop);
+            
+            auto* newPlan = plans.add (new Plan (order, hopSize, window));
+            buildBandMap (*newPlan);
+            
+            for (int scale = 0; scale < numFilterbankScales; ++scale)
+                newPlan->filterbanks[scale].build ((Filterbank::Scale) scale, fftSize, sampleRate, numBandsPerChannel);
+        }
+        
+        plan = plans[defaultFftOrder - minFftOrder];
+        dynamics.setFrameRate (plan->stft.getFrameRate (sampleRate));
+        
+        // The scratch space and spectra are sized for the largest FFT
+        const int maxNumBins = plans.getLast()->stft.getNumBins();
+        
+        monoBuffer.calloc (maxSamplesPerRead);
+        rightBuffer.calloc (maxSamplesPerRead);
+        powerScratch.calloc ((size_t) maxNumBins);
+        filterbankLevels.calloc ((size_t) numBandsPerChannel);
+        hopLevels.calloc ((size_t) numBands);
+        hopPeaks.calloc ((size_t) numBands);
+        rowLevels.calloc ((size_t) numBands);
+        rowPeaks.calloc ((size_t) numBands);
+    }
+    
+    ~SpectrumAnalyser()
+    {
+        stopThread (stopTimeoutMs);
+        ringBuffer.removeConsumer (ringBufferConsumer);
+    }
+    
+    /** The rows published for the render thread. Only one thread may read
+        from it.
+     */
+    TripleBuffer<Frame>& getFrames() noexcept       { return frames; }
+    
+    /** Switches the analysis to an FFT size of 2^order samples, from 2^8 to
+        2^16. Can be called from any thread while the analyser runs, the
+        analysis thread switches before it analyses any more samples. The
+        new size produces its first row once it has a full FFT of samples.
+     */
+    void setFftOrder (int order) noexcept
+    {
+        requestedFftOrder.store (jlimit ((int) minFftOrder, (int) maxFftOrder, order), std::memory_order_relaxed);
+    }
+    
+    /** Returns the FFT order last asked for with setFftOrder(). */
+    int getFftOrder() const noexcept                { return requestedFftOrder.load (std::memory_order_relaxed); }
+    
+    /** Switches how the bands are spread over the frequencies. Can be called
+        from any thread while the analyser runs, the next row uses it.
+     */
+    void setFrequencyScale (FrequencyScale scale) noexcept
+    {
+        frequencyScale.store (scale, std::memory_order_relaxed);
+    }
+    
+    FrequencyScale getFrequencyScale() const noexcept
+    {
+        return frequencyScale.load (std::memory_order_relaxed);
+    }
+    
+    /** Sets the attack, release, peak hold and auto-gain of the rows. Can be
+        called from any thread while the analyser runs, the next row uses them.
+     */
+    void setDynamics (const SpectrumDynamics::Settings& newSettings)
+    {
+        const SpinLock::ScopedLockType lock (dynamicsLock);
+        pendingDynamics = newSettings;
+        dynamicsChanged = true;
+    }
+    
+    //==========================================================================
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            // Sleep until the audio callback has had time to write more
+            if (! analyseNewSamples())
+                wait (idleWaitMs);
+        }
+    }
+
+private:
+    
+    enum
+    {
+        minFftOrder = 8,
+        maxFftOrder = 16,
+        defaultFftOrder = 10,
+        defaultHopSize = (1 << defaultFftOrder) / 4,    // 75% overlap at the default size
+        maxFramesPerFft = 16,   // Keeps the cost of the largest FFTs in check
+        maxSamplesPerRead = 1024,
+        numFilterbankScales = 3,    // The FrequencyScales after skewed
+        fallbackSampleRate = 44100, // If the ring doesn't know its sample rate
+        idleWaitMs = 2,         // Short enough to keep up with small audio blocks
+        stopTimeoutMs = 500
+    };
+    
+    /** An STFT of one size, and which of its bins fall into every band. */
+    struct Plan
+    {
+        Plan (int fftOrder, int samplesPerHop, STFT::WindowingMethod window)
+        :   order (fftOrder),
+            stft (fftOrder, samplesPerHop, window)
+        {
+        }
+        
+        const int order;
+        STFT stft;
+        
+        // The bins of every band, from bandStartBins up to but not including
+        // bandEndBins. See buildBandMap().
+        std::vector<int> bandStartBins;
+        std::vector<int> bandEndBins;
+        
+        // Used instead of the band map by the other FrequencyScales
+        Filterbank filterbanks[numFilterbankScales];
+    };
+    
+    /** Pulls every sample written since the last call from the ring buffer and
+        feeds them to the STFT, publishing a row for every frame it completes.
+        
+        @returns    true if at least one frame was analysed
+     */
+    bool analyseNewSamples()
+    {
+        bool analysedAFrame = false;
+        
+        // Switch FFT size if asked to. The new STFT starts afresh, but the
+        // bands don't change, so the smoothing carries on.
+        const int fftOrder = requestedFftOrder.load (std::memory_order_relaxed);
+        
+        if (fftOrder != plan->order)
+        {
+            plan = plans[fftOrder - minFftOrder];
+            plan->stft.reset();
+            
+            // The hop may have changed, and the time constants are in rows
+            dynamics.setFrameRate (plan->stft.getFrameRate (sampleRate));
+        }
+        
+        if (dynamicsChanged.exchange (false))
+        {
+            const SpinLock::ScopedLockType lock (dynamicsLock);
+            dynamics.setSettings (pendingDynamics);
+        }
+        
+        STFT& stft = plan->stft;
+        
+        for (;;)
+        {
+            // Look at the new samples in place, instead of copying them out of
+            // the ring buffer first
+            int64 droppedSamples = 0;
+            const auto view = ringBuffer.getNewSamplesView (ringBufferConsumer, maxSamplesPerRead, droppedSamples);
+            const int numNewSamples = view.getNumSamples();
+            
+            if (numNewSamples == 0)
+                break;
+            
+            // If we fell behind the writer, the samples in the STFT are no
+            // longer continuous with the new ones, so start afresh
+            if (droppedSamples > 0)
+                stft.reset();
+            
+            if (channelLayout == ChannelLayout::stereoSplit)
+            {
+                // Keep the left and right channels seperate. A mono ring shows
+                // the same channel on both halves.
+                view.copyChannelTo (0, monoBuffer);
+                view.copyChannelTo (jmin (1, ringBuffer.getNumChannels() - 1), rightBuffer);
+            }
+            else
+            {
+                // Sum channels together
+                view.copyChannelTo (0, monoBuffer);
+                
+                for (int i = 1; i < ringBuffer.getNumChannels(); ++i)
+                    view.addChannelTo (i, monoBuffer);
+            }
+            
+            // If the writer overwrote the samples while we copied them, throw
+            // them away. The next read reports them as dropped.
+            if (! ringBuffer.releaseView (ringBufferConsumer, view))
+                break;
+            
+            if (channelLayout == ChannelLayout::stereoSplit)
+            {
+                stft.pushStereoSamples (monoBuffer, rightBuffer, numNewSamples,
+                                        [this, &analysedAFrame] (const float* leftMagnitudes, const float* rightMagnitudes)
+                {
+                    publishFrame (leftMagnitudes, rightMagnitudes);
+                    analysedAFrame = true;
+                });
+            }
+            else
+            {
+                stft.pushSamples (monoBuffer, numNewSamples, [this, &analysedAFrame] (const float* magnitudes)
+                {
+                    publishFrame (magnitudes, nullptr);
+                    analysedAFrame = true;
+                });
+            }
+        }
+        
+        return analysedAFrame;
+    }
+    
+    /** Works out which FFT bins of a plan's STFT fall into every band of one
+        channel. Only needs to run again if the number of bands changes.
+        
+        The bands are spaced on a skewed scale, so the low frequencies get more
+        of the display. Band 0 is the highest frequency, matching the columns
+        of the Spectrum, and each band reaches halfway to its neighbours so
+        every bin is covered.
+     */
+    void buildBandMap (Plan& planToMap)
+    {
+        const int numBins = planToMap.stft.getNumBins();
+        std::vector<int>& bandStartBins = planToMap.bandStartBins;
+        std::vector<int>& bandEndBins = planToMap.bandEndBins;
+        
+        bandStartBins.resize ((size_t) numBandsPerChannel);
+        bandEndBins.resize ((size_t) numBandsPerChannel);
+        
+        // The bin a (fractional) band index is centred on
+        auto binForBand = [this, numBins] (float band)
+        {
+            const float proportion = jlimit (0.0f, 1.0f, band / ((float) numBandsPerChannel - 1.0f));
+            const float skewedProportionY = 1.0f - std::pow (proportion, 0.2f);
+            return jlimit (0, numBins, roundToInt (skewedProportionY * (float) (numBins - 1)));
+        };
+        
+        for (int i = 0; i < numBandsPerChannel; ++i)
+        {
+            const int startBin = binForBand ((float) i + 0.5f);
+            const int endBin = i == 0 ? numBins : binForBand ((float) i - 0.5f);
+            
+            // Every band reads at least one bin, even where bands are narrower
+            // than the bins
+            bandStartBins[(size_t) i] = jmin (startBin, numBins - 1);
+            bandEndBins[(size_t) i] = jmax (endBin, bandStartBins[(size_t) i] + 1);
+        }
+    }
+    
+    /** Reduces an STFT frame onto the bands, smooths and scales them, and
+        publishes the loudest levels since the renderer took the last row.
+        rightMagnitudes is only used in stereo.
+     */
+    void publishFrame (const float* magnitudes, const float* rightMagnitudes)
+    {
+        reduceToBands (magnitudes, hopLevels);
+        
+        if (channelLayout == ChannelLayout::stereoSplit)
+        {
+            // The right channel is mirrored, so its lowest band meets the
+            // left channel's in the middle
+            float* rightLevels = hopLevels + numBandsPerChannel;
+            reduceToBands (rightMagnitudes, rightLevels);
+            std::reverse (rightLevels, rightLevels + numBandsPerChannel);
+            
+            // With an odd number of bands, the one left over stays silent
+            if (numBands > 2 * numBandsPerChannel)
+                hopLevels[numBands - 1] = 0.0f;
+        }
+        
+        // Smooth over time, and scale so we show up the detail clearly
+        // without the whole row jumping with its loudest band. This runs at
+        // every hop, so the time constants don't depend on the frame rate.
+        dynamics.process (hopLevels, hopPeaks);
+        
+        // Keep the loudest of the hops since the renderer took the last row,
+        // so a short peak isn't missed between two pickups. Once it has
+        // taken the row, start collecting the next one.
+        if (frames.hasNewFrame())
+        {
+            FloatVectorOperations::max (rowLevels, rowLevels, hopLevels, numBands);
+            FloatVectorOperations::max (rowPeaks, rowPeaks, hopPeaks, numBands);
+        }
+        else
+        {
+            FloatVectorOperations::copy (rowLevels, hopLevels, numBands);
+            FloatVectorOperations::copy (rowPeaks, hopPeaks, numBands);
+        }
+        
+        Frame& frame = frames.getWriteFrame();
+        FloatVectorOperations::copy (frame.levels.data(), rowLevels, numBands);
+        FloatVectorOperations::copy (frame.peaks.data(), rowPeaks, numBands);
+        
+        frames.publish();
+    }
+    
+    /** Reduces one channel's spectrum to numBandsPerChannel levels. */
+    void reduceToBands (const float* spectrum, float* bandLevels)
+    {
+        const std::vector<int>& bandStartBins = plan->bandStartBins;
+        const std::vector<int>& bandEndBins = plan->bandEndBins;
+        const FrequencyScale scale = frequencyScale.load (std::memory_order_relaxed);
+        
+        if (scale != FrequencyScale::skewed)
+        {
+            // The filterbank works on power, and gives its bands from low to
+            // high frequencies
+            const Filterbank& filterbank = plan->filterbanks[(int) scale - 1];
+            const int numFilterbankBands = filterbank.getNumBands();
+            
+            FloatVectorOperations::multiply (powerScratch, spectrum, spectrum, plan->stft.getNumBins());
+            filterbank.process (powerScratch, filterbankLevels);
+            
+            // Band 0 is the highest frequency. A bank with fewer bands than
+            // we have, e.g. third octaves, is drawn as wider steps.
+            for (int i = 0; i < numBandsPerChannel; ++i)
+                bandLevels[i] = filterbankLevels[numFilterbankBands - 1 - (i * numFilterbankBands) / numBandsPerChannel];
+        }
+        else if (bandReduction == BandReduction::rms)
+        {
+            // Every band sums its own bins in double. A running sum over all
+            // bins would lose the quiet high bands to cancellation.
+            for (int i = 0; i < numBandsPerChannel; ++i)
+            {
+                const int startBin = bandStartBins[(size_t) i];
+                const int endBin = bandEndBins[(size_t) i];
+                double energy = 0.0;
+                
+                for (int bin = startBin; bin < endBin; ++bin)
+                    energy += (double) spectrum[bin] * spectrum[bin];
+                
+                bandLevels[i] = (float) std::sqrt (energy / (endBin - startBin));
+            }
+        }
+        else
+        {
+            for (int i = 0; i < numBandsPerChannel; ++i)
+            {
+                const int startBin = bandStartBins[(size_t) i];
+                bandLevels[i] = FloatVectorOperations::findMaximum (spectrum + startBin,
+                                                                    bandEndBins[(size_t) i] - startBin);
+            }
+        }
+    }
+    
+    //==========================================================================
+    VisualizerRingBuffer& ringBuffer;
+    int ringBufferConsumer;             // Our read cursor in the ring buffer
+    const int numBands;
+    const ChannelLayout channelLayout;
+    const int numBandsPerChannel;
+    const BandReduction bandReduction;
+    const double sampleRate;
+    std::atomic<FrequencyScale> frequencyScale { FrequencyScale::skewed };
+    
+    OwnedArray<Plan> plans;             // One for every order from minFftOrder to maxFftOrder
+    Plan* plan;                         // The one in use, only touched by the analysis thread
+    std::atomic<int> requestedFftOrder { defaultFftOrder };
+    
+    HeapBlock<float> monoBuffer;        // The channels of the latest read summed, or the left one in stereo
+    HeapBlock<float> rightBuffer;       // The right channel of the latest read in stereo
+    HeapBlock<float> powerScratch;      // Squared magnitudes for the filterbank reductions. Frames are
+                                        // published while the input buffers are still being read.
+    HeapBlock<float> filterbankLevels;  // The Filterbank's bands, lowest first
+    HeapBlock<float> hopLevels;         // The bands of the latest frame, then smoothed
+    HeapBlock<float> hopPeaks;          // The held peaks after the latest frame
+    HeapBlock<float> rowLevels;         // The loudest hopLevels since the last row was taken
+    HeapBlock<float> rowPeaks;          // The loudest hopPeaks since the last row was taken
+    
+    SpectrumDynamics dynamics;          // Only touched by the analysis thread
+    SpinLock dynamicsLock;              // Guards pendingDynamics
+    SpectrumDynamics::Settings pendingDynamics;
+    std::atomic<bool> dynamicsChanged { false };
+    
+    TripleBuffer<Frame> frames;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpectrumAnalyser)
+};
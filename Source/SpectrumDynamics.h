@@ -0,0 +1,170 @@
+//
+//  SpectrumDynamics.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <cmath>
+
+/** Smooths a stream of spectrum rows over time, so the display moves like a
+    meter instead of jumping with every frame.
+    
+    Every row goes through three stages, each run over the whole row at once:
+    an envelope per band that rises with the attack time and falls with the
+    release time, a peak per band that holds for a while and then decays, and
+    a slow automatic gain that keeps the loudest band near the top of the
+    display without pumping on every frame.
+    
+    All memory is allocated in the constructor, so processing is cheap enough
+    to run at every hop of the analysis, even at 1000 rows per second.
+ */
+class SpectrumDynamics
+{
+public:
+    
+    struct Settings
+    {
+        float attackMs = 5.0f;              // Time for a band to rise most of the way to a louder input
+        float releaseMs = 150.0f;           // Time for it to fall most of the way to a quieter one
+        float peakHoldMs = 500.0f;          // Time a peak stays put before decaying
+        float peakDecayDbPerSecond = 12.0f;
+        bool autoGain = true;               // If false, a full scale sine shows as 1
+        float autoGainSeconds = 3.0f;       // Time for the gain to follow the signal getting quieter
+    };
+    
+    /** Creates the processor for rows of numBandsToProcess levels. */
+    explicit SpectrumDynamics (int numBandsToProcess)
+    :   numBands (numBandsToProcess)
+    {
+        envelope.calloc ((size_t) numBands);
+        peaks.calloc ((size_t) numBands);
+        holdFramesLeft.calloc ((size_t) numBands);
+        rising.calloc ((size_t) numBands);
+        falling.calloc ((size_t) numBands);
+        
+        updateCoefficients();
+    }
+    
+    /** Sets the time constants. Only call it on the thread that processes. */
+    void setSettings (const Settings& newSettings) noexcept
+    {
+        settings = newSettings;
+        updateCoefficients();
+    }
+    
+    const Settings& getSettings() const noexcept    { return settings; }
+    
+    /** Sets how many rows are processed per second, which the time constants
+        are converted with. Only call it on the thread that processes.
+     */
+    void setFrameRate (double newFramesPerSecond) noexcept
+    {
+        framesPerSecond = jmax (1.0, newFramesPerSecond);
+        updateCoefficients();
+    }
+    
+    /** Forgets the history, e.g. when the input jumps. */
+    void reset() noexcept
+    {
+        FloatVectorOperations::clear (envelope, numBands);
+        FloatVectorOperations::clear (peaks, numBands);
+        FloatVectorOperations::clear (holdFramesLeft, numBands);
+        gainLevel = minimumGainLevel;
+    }
+    
+    /** Processes one row.
+    
+        @param levels       the row's levels, replaced by the smoothed levels
+                            with the gain applied, limited to [0, 1]
+        @param peakLevels   receives the held peaks, with the same gain
+     */
+    void process (float* levels, float* peakLevels) noexcept
+    {
+        // Envelope, without a branch per band:
+        //     envelope += attack * (max (level, envelope) - envelope)
+        //              + release * (min (level, envelope) - envelope)
+        // Only one of the two differences is non-zero for each band.
+        FloatVectorOperations::max (rising, levels, envelope, numBands);
+        FloatVectorOperations::subtract (rising, envelope, numBands);
+        FloatVectorOperations::min (falling, levels, envelope, numBands);
+        FloatVectorOperations::subtract (falling, envelope, numBands);
+        FloatVectorOperations::addWithMultiply (envelope, rising, attackCoefficient, numBands);
+        FloatVectorOperations::addWithMultiply (envelope, falling, releaseCoefficient, numBands);
+        
+        // Peak hold. Written with selects rather than branches so the
+        // compiler can vectorise it like the rest.
+        for (int i = 0; i < numBands; ++i)
+        {
+            const bool newPeak = envelope[i] >= peaks[i];
+            const float framesLeft = newPeak ? holdFrames : holdFramesLeft[i] - 1.0f;
+            
+            holdFramesLeft[i] = framesLeft;
+            peaks[i] = newPeak ? envelope[i] : (framesLeft > 0.0f ? peaks[i] : peaks[i] * peakDecay);
+        }
+        
+        // Auto-gain follows the loudest band, quickly up so it doesn't clip
+        // for long, and slowly down so quiet passages don't pump
+        float gain = 1.0f;
+        
+        if (settings.autoGain)
+        {
+            const float loudest = FloatVectorOperations::findMaximum (envelope.get(), numBands);
+            const float coefficient = loudest > gainLevel ? attackCoefficient : autoGainCoefficient;
+            
+            gainLevel = jmax (minimumGainLevel, gainLevel + coefficient * (loudest - gainLevel));
+            gain = 1.0f / gainLevel;
+        }
+        
+        FloatVectorOperations::multiply (levels, envelope, gain, numBands);
+        FloatVectorOperations::clip (levels, levels, 0.0f, 1.0f, numBands);
+        
+        FloatVectorOperations::multiply (peakLevels, peaks, gain, numBands);
+        FloatVectorOperations::clip (peakLevels, peakLevels, 0.0f, 1.0f, numBands);
+    }
+
+private:
+    
+    /** Returns the one pole coefficient that covers 1 - 1/e of the way to
+        the target in the given time.
+     */
+    float coefficientFor (float milliseconds) const noexcept
+    {
+        if (milliseconds <= 0.0f)
+            return 1.0f;
+        
+        return (float) (1.0 - std::exp (-1000.0 / (milliseconds * framesPerSecond)));
+    }
+    
+    void updateCoefficients() noexcept
+    {
+        attackCoefficient = coefficientFor (settings.attackMs);
+        releaseCoefficient = coefficientFor (settings.releaseMs);
+        autoGainCoefficient = coefficientFor (1000.0f * settings.autoGainSeconds);
+        
+        holdFrames = (float) (settings.peakHoldMs * 0.001 * framesPerSecond);
+        peakDecay = (float) std::pow (10.0, -settings.peakDecayDbPerSecond / (20.0 * framesPerSecond));
+    }
+    
+    // The gain never goes above 80dB, so silence isn't blown up to full scale
+    static constexpr float minimumGainLevel = 1.0e-4f;
+    
+    const int numBands;
+    Settings settings;
+    double framesPerSecond = 60.0;
+    
+    float attackCoefficient, releaseCoefficient, autoGainCoefficient;
+    float holdFrames, peakDecay;
+    float gainLevel = minimumGainLevel;
+    
+    HeapBlock<float> envelope;          // The smoothed level of every band
+    HeapBlock<float> peaks;             // The held peak of every band
+    HeapBlock<float> holdFramesLeft;    // Frames until each peak starts decaying
+    HeapBlock<float> rising, falling;   // Scratch space for the envelope
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpectrumDynamics)
+};
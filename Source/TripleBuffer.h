@@ -0,0 +1,138 @@
+//
+//  TripleBuffer.h
+//  3DAudioVisualizers
+//
+//  Created on 10/16/26.
+//
+//
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+
+/** A wait-free mailbox that hands the latest complete frame from one writer
+    thread to one reader thread, e.g. a spectrum from an analysis thread to a
+    renderer.
+    
+    There are three frames: one the writer fills, one the reader uses, and a
+    spare in between. Publishing swaps the writer's frame with the spare, and
+    the reader picks up the spare by swapping it with its own frame. Each swap
+    is a single atomic exchange, so neither side ever waits or sees a frame
+    that is still being written. If the writer publishes several frames before
+    the reader looks, the older ones are simply replaced.
+    
+    FrameType must be default constructible or copy constructible from an
+    initial frame. Nothing is allocated after construction, so frames that own
+    memory (e.g. a HeapBlock or std::vector) should be sized up front.
+    
+    Usage on the writer thread:
+        
+        auto& frame = mailbox.getWriteFrame();
+        // ...fill frame...
+        mailbox.publish();
+    
+    And on the reader thread:
+        
+        if (mailbox.update())
+            draw (mailbox.getReadFrame());
+ */
+template <class FrameType>
+class TripleBuffer
+{
+public:
+    
+    /** Creates the buffer with default constructed frames. */
+    TripleBuffer() = default;
+    
+    /** Creates the buffer with three copies of initialFrame. Use this to size
+        frames that hold their data on the heap.
+     */
+    explicit TripleBuffer (const FrameType& initialFrame)
+    {
+        for (auto& slot : slots)
+            slot.frame = initialFrame;
+    }
+    
+    //==========================================================================
+    // Writer
+    
+    /** Returns the frame the writer may fill. Its contents are whatever was
+        last written to it, which is usually two frames old.
+     */
+    FrameType& getWriteFrame() noexcept             { return slots[writeIndex].frame; }
+    
+    /** Makes the write frame the newest frame for the reader, and gives the
+        writer a different frame to fill next. Wait-free.
+     */
+    void publish() noexcept
+    {
+        // Release makes the frame's contents visible to the reader, acquire
+        // makes sure the reader is done with the frame we get back
+        const int previousSpare = spare.exchange (writeIndex | newFrameFlag, std::memory_order_acq_rel);
+        writeIndex = previousSpare & indexMask;
+    }
+    
+    //==========================================================================
+    // Reader
+    
+    /** Picks up the newest published frame, if there is one since the last
+        call. Wait-free.
+        
+        @returns    true if getReadFrame() now holds a frame it didn't before
+     */
+    bool update() noexcept
+    {
+        // Nothing new, keep the current frame
+        if ((spare.load (std::memory_order_relaxed) & newFrameFlag) == 0)
+            return false;
+        
+        const int previousSpare = spare.exchange (readIndex, std::memory_order_acq_rel);
+        readIndex = previousSpare & indexMask;
+        return true;
+    }
+    
+    /** Returns the frame picked up by the last successful update(). Before any
+        frame has been published this is the initial frame.
+     */
+    const FrameType& getReadFrame() const noexcept  { return slots[readIndex].frame; }
+    
+    /** Returns true if a frame has been published that update() hasn't picked
+        up yet.
+     */
+    bool hasNewFrame() const noexcept
+    {
+        return (spare.load (std::memory_order_relaxed) & newFrameFlag) != 0;
+    }
+
+private:
+    
+    enum
+    {
+        cacheLineSize = 64,
+        indexMask = 3,
+        newFrameFlag = 4     // Set in spare when it holds an unread frame
+    };
+    
+    // Each frame and index is kept a cache line away from the others, so the
+    // writer filling one frame doesn't false share with the reader using
+    // another. This is done with padding rather than alignas, so that classes
+    // holding a TripleBuffer aren't over-aligned and can be created with plain
+    // operator new on every deployment target.
+    struct Slot
+    {
+        char padding [cacheLineSize];
+        FrameType frame;
+    };
+    
+    Slot slots[3];
+    
+    char writerPadding [cacheLineSize];
+    int writeIndex = 0;                 // Only used by the writer
+    char sparePadding [cacheLineSize];
+    std::atomic<int> spare { 1 };
+    char readerPadding [cacheLineSize];
+    int readIndex = 2;                  // Only used by the reader
+    
+    JUCE_DECLARE_NON_COPYABLE (TripleBuffer)
+};